@@ -0,0 +1,36 @@
+#ifndef BENCH_FIXTURE_H
+#define BENCH_FIXTURE_H
+
+#include <chrono>
+#include <string>
+
+#include "json.hpp"
+
+// shared by the benchmarks: a clock, and a document of the attempts
+// collection as the judge stores it
+
+inline double seconds() {
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+inline JSON attempt(int id) {
+  return std::map<std::string,JSON>{
+    {"contest"      , 1},
+    {"contest_time" , 60*id},
+    {"language"     , ".cpp"},
+    {"memory"       , "3456"},
+    {"privileged"   , false},
+    {"problem"      , 1+id%10},
+    {"status"       , "judged"},
+    {"time"         , "12.345"},
+    {"user"         , 1+id%100},
+    {"username"     , "team"+std::to_string(1+id%100)},
+    {"verdict"      , "AC"},
+    {"wall_time"    , "13.001"},
+    {"when"         , 1700000000+id}
+  };
+}
+
+#endif
@@ -0,0 +1,54 @@
+#include <cstdio>
+
+#include "fixture.hpp"
+
+using namespace std;
+
+// JSON values as the judge uses them: documents of the attempts collection,
+// copied out of the database and read field by field, and the whole
+// collection as text, parsed and generated
+
+static void report(const char* what, double start, int n) {
+  printf("%-24s %10.1f ns\n",what,(seconds()-start)*1e9/n);
+}
+
+static void throughput(const char* what, double start, size_t bytes) {
+  printf("%-24s %10.1f MB/s\n",what,bytes/(seconds()-start)/1e6);
+}
+
+int main() {
+  static const int n = 300000;
+  JSON att = attempt(17);
+  long long sum = 0; // keeps the loops from being optimized away
+  double t = seconds();
+  for (int i = 0; i < n; i++) sum += int(att["user"]);
+  report("read an integer field",t,n);
+  t = seconds();
+  for (int i = 0; i < n; i++) sum += att["status"].str().size();
+  report("read a string field",t,n);
+  t = seconds();
+  for (int i = 0; i < n; i++) {
+    JSON tmp = att;
+    sum += tmp.size();
+  }
+  report("copy a document",t,n);
+  t = seconds();
+  for (int i = 0; i < n; i++) sum += attempt(i).size();
+  report("build a document",t,n);
+  JSON all(vector<JSON>{});
+  for (int i = 0; i < n/10; i++) all.push_back(attempt(i));
+  t = seconds();
+  string text = all.generate();
+  throughput("generate compact",t,text.size());
+  t = seconds();
+  string indented = all.generate(1);
+  throughput("generate indented",t,indented.size());
+  JSON tmp;
+  t = seconds();
+  sum += tmp.parse(text);
+  throughput("parse compact",t,text.size());
+  t = seconds();
+  sum += tmp.parse(indented);
+  throughput("parse indented",t,indented.size());
+  return sum == 42;
+}
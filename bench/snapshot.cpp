@@ -0,0 +1,46 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "database.hpp"
+#include "helper.hpp"
+
+#include "fixture.hpp"
+
+using namespace std;
+
+// loading a collection at startup: from a binary snapshot, and from the JSON
+// file used when there is none. runs in a temporary directory
+
+static int remove_entry(const char* fn, const struct stat*, int, FTW*) {
+  return remove(fn);
+}
+
+int main() {
+  static const int n = 50000;
+  char dir[] = "/tmp/pjudge-benchXXXXXX";
+  if (!mkdtemp(dir) || chdir(dir) < 0) return 1;
+  mkdir("database",0755);
+  JSON docs(vector<JSON>{});
+  for (int i = 1; i <= n; i++) docs.emplace_back(map<string,JSON>{
+    {"_id"      , i},
+    {"document" , attempt(i)}
+  });
+  docs.write_file("database/snap.json");
+  docs.write_file("database/json.json");
+  Database::import_json(); // both get snapshots...
+  remove("database/json.snap"); // ...but one must be loaded from JSON
+  system("du -h database/snap.snap database/json.json");
+  double t = seconds();
+  Database::Collection snap("snap");
+  printf("load from snapshot %10.1f ms\n",(seconds()-t)*1e3);
+  t = seconds();
+  Database::Collection json("json");
+  printf("load from JSON     %10.1f ms\n",(seconds()-t)*1e3);
+  bool ok = snap.retrieve(n).equals(json.retrieve(n));
+  nftw(dir,remove_entry,16,FTW_DEPTH|FTW_PHYS); // contents first
+  return !ok;
+}
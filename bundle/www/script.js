@@ -225,7 +225,7 @@ function contest_scoreboard(id) {
       )
     );
     var n = resp.colors.length;
-    var sc = compute_scoreboard(n,resp.attempts);
+    var sc = resp.teams;
     var html =
       "<h2>Scoreboard"+msg+"</h2>"+
       "<table class=\"data\">"+
@@ -480,44 +480,6 @@ function sort_contest_attempts(atts) {
   });
 }
 
-function compute_scoreboard(nprobs,atts) {
-  sort_contest_attempts(atts);
-  var new_user = function(name) {
-    var ans = {name: name, problems: [], ACs: [], score: {num: 0, time: 0}};
-    for (var i = 0; i < nprobs; i++) ans.problems.push({atts: 0, time: 0});
-    return ans;
-  };
-  var users = {};
-  for (var i = 0; i < atts.length; i++) {
-    var att = atts[i];
-    if (!(att.user in users)) users[att.user] = new_user(att.user);
-    var us = users[att.user];
-    var p = us.problems[att.problem];
-    if (p.atts > 0) continue;
-    if (att.verdict != "AC") p.atts--;
-    else {
-      p.atts = 1-p.atts;
-      p.time = att.contest_time;
-      us.ACs.push(att.contest_time);
-      us.score.num++;
-      us.score.time += 20*(p.atts-1)+p.time;
-    }
-  }
-  var ans = [];
-  for (us in users) if ("problems" in users[us]) ans.push(users[us]);
-  ans.sort(function(a,b) {
-    if (a.score.num != b.score.num) return b.score.num-a.score.num;
-    if (a.score.time != b.score.time) return a.score.time-b.score.time;
-    for (var i = a.score.num-1; 0 <= i; i--) {
-      if (a.ACs[i] != b.ACs[i]) return a.ACs[i]-b.ACs[i];
-    }
-    if (a.name < b.name) return -1;
-    if (a.name > b.name) return  1;
-    return 0;
-  });
-  return ans;
-}
-
 function timestamp(svtime) {
   return new Date(time(svtime)).toString();
 }
@@ -53,6 +53,7 @@ string create(JSON&& att, const vector<uint8_t>& src) {
   // update db
   DB(attempts);
   int id = attempts.create(att);
+  if (!id) return "Attempt could not be saved. Try again later.";
   // save file
   string fn = "attempts/"+tostr(id)+"/";
   system("mkdir -p %soutput",fn.c_str());
@@ -87,6 +88,7 @@ JSON get(int id, int user) {
   ans["source"] = source("attempts/"+tostr(id)+"/"+tostr(pid)+ext);
   ans.erase("ip");
   ans.erase("time");
+  ans.erase("wall_time");
   ans.erase("memory");
   if (ans["status"] != "judged") ans.erase("verdict");
   return ans;
@@ -101,7 +103,10 @@ JSON page(
   bool profile
 ) {
   DB(attempts);
-  JSON tmp = attempts.retrieve(), ans(vector<JSON>{}), aux;
+  JSON filter;
+  if (contest) filter["contest"] = contest;
+  if (!scoreboard && !profile) filter["user"] = user;
+  JSON tmp = attempts.retrieve(filter), ans(vector<JSON>{}), aux;
   for (auto& att : tmp.arr()) {
     if (!scoreboard && !profile && int(att["user"]) != user) continue;
     if ((scoreboard || profile) && att("privileged")) continue;
@@ -124,6 +129,7 @@ JSON page(
     });
     att.erase("ip");
     att.erase("time");
+    att.erase("wall_time");
     att.erase("memory");
     if (att["status"] != "judged") {
       if (scoreboard) continue;
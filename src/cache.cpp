@@ -0,0 +1,225 @@
+#include <set>
+#include <map>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "cache.hpp"
+
+#include "helper.hpp"
+
+using namespace std;
+
+// each entry is compile-cache/<hash of key>/, with the key itself in key (to
+// tell collisions from hits) and the artifacts in files/. entries are built in
+// compile-cache/tmp* and renamed into place, and the last use of an entry is
+// the mtime of its key
+
+#define ROOT "compile-cache"
+
+struct Entry {
+  long long size;
+  time_t used;
+};
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static map<string,Entry> entries; // by hash
+static long long total = 0, max_size = 0;
+
+static string digest(const string& key) { // fnv-1a
+  unsigned long long h = 14695981039346656037ULL;
+  for (unsigned char c : key) h = (h^c)*1099511628211ULL;
+  return stringf("%016llx",h);
+}
+
+static map<string,timespec> files(const string& dir) { // regular, by mtime
+  map<string,timespec> ans;
+  DIR* dp = opendir(dir.c_str());
+  if (!dp) return ans;
+  for (dirent* ent = readdir(dp); ent; ent = readdir(dp)) {
+    struct stat st;
+    string fn = dir+"/"+ent->d_name;
+    if (!stat(fn.c_str(),&st) && S_ISREG(st.st_mode)) {
+      ans[ent->d_name] = st.st_mtim;
+    }
+  }
+  closedir(dp);
+  return ans;
+}
+
+static long long copy(int in, const string& dst) { // size or -1
+  struct stat st;
+  if (fstat(in,&st) < 0) return -1;
+  int out = open(dst.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,st.st_mode);
+  if (out < 0) return -1;
+  static const size_t bufsize = 1<<16;
+  unique_ptr<char[]> buf(new char[bufsize]);
+  long long ans = 0;
+  for (ssize_t n; ans >= 0 && (n = read(in,buf.get(),bufsize)) != 0;) {
+    if (n < 0) { if (errno != EINTR) ans = -1; continue; }
+    if (write(out,buf.get(),n) != n) ans = -1;
+    else ans += n;
+  }
+  if (close(out) < 0) ans = -1;
+  return ans;
+}
+
+static long long copy(const string& src, const string& dst) { // size or -1
+  int in = open(src.c_str(),O_RDONLY|O_CLOEXEC);
+  if (in < 0) return -1;
+  long long ans = copy(in,dst);
+  close(in);
+  return ans;
+}
+
+static string read_file(const string& fn) {
+  string ans;
+  int fd = open(fn.c_str(),O_RDONLY|O_CLOEXEC);
+  if (fd < 0) return ans;
+  char buf[1<<12];
+  for (ssize_t n; (n = read(fd,buf,sizeof buf)) != 0;) {
+    if (n < 0) { if (errno == EINTR) continue; break; }
+    ans.append(buf,n);
+  }
+  close(fd);
+  return ans;
+}
+
+static void drop(const string& h) { // with cache_mutex locked
+  auto it = entries.find(h);
+  if (it == entries.end()) return;
+  total -= it->second.size;
+  entries.erase(it);
+  system("rm -rf %s/%s",ROOT,h.c_str());
+}
+
+static void evict() { // with cache_mutex locked
+  while (total > max_size && !entries.empty()) {
+    auto lru = entries.begin();
+    for (auto it = entries.begin(); it != entries.end(); it++) {
+      if (it->second.used < lru->second.used) lru = it;
+    }
+    drop(lru->first);
+  }
+}
+
+static bool fetch(const string& key, const string& h, const string& dir) {
+  // the artifacts are opened with the lock held and copied without it: the
+  // open descriptors keep them alive if the entry is dropped meanwhile
+  map<string,int> fds;
+  pthread_mutex_lock(&cache_mutex);
+  auto it = entries.find(h);
+  string entry = string(ROOT)+"/"+h;
+  bool ok = it != entries.end() && read_file(entry+"/key") == key;
+  if (ok) for (auto& f : files(entry+"/files")) {
+    int fd = open((entry+"/files/"+f.first).c_str(),O_RDONLY|O_CLOEXEC);
+    if (fd < 0) { ok = false; break; }
+    fds[f.first] = fd;
+  }
+  if (ok) {
+    it->second.used = time(nullptr);
+    utime((entry+"/key").c_str(),nullptr);
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  for (auto& f : fds) {
+    if (ok && copy(f.second,dir+"/"+f.first) < 0) ok = false;
+    close(f.second);
+  }
+  return ok;
+}
+
+static void store(
+  const string& key,
+  const string& h,
+  const string& dir,
+  const set<string>& artifacts
+) {
+  char tmp[] = ROOT "/tmpXXXXXX";
+  if (!mkdtemp(tmp)) return;
+  chmod(tmp,0755);
+  string entry = tmp;
+  long long size = key.size();
+  int fd = open((entry+"/key").c_str(),O_WRONLY|O_CREAT|O_CLOEXEC,0644);
+  if (fd < 0 || write(fd,key.c_str(),key.size()) != ssize_t(key.size())) {
+    size = -1;
+  }
+  if (fd >= 0) close(fd);
+  mkdir((entry+"/files").c_str(),0755);
+  for (auto& fn : artifacts) {
+    if (size < 0) break;
+    long long n = copy(dir+"/"+fn,entry+"/files/"+fn);
+    size = (n < 0 ? -1 : size+n);
+  }
+  pthread_mutex_lock(&cache_mutex);
+  if (0 <= size && size <= max_size) {
+    drop(h); // a collision, or stored meanwhile by another worker
+    if (!rename(tmp,(string(ROOT)+"/"+h).c_str())) {
+      entries[h] = Entry{size,time(nullptr)};
+      total += size;
+      evict();
+    }
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  system("rm -rf %s",tmp); // if it wasn't renamed
+}
+
+namespace Cache {
+
+void init(long long size) {
+  max_size = size;
+  if (max_size <= 0) return;
+  mkdir(ROOT,0755);
+  DIR* dp = opendir(ROOT);
+  if (!dp) { max_size = 0; return; }
+  for (dirent* ent = readdir(dp); ent; ent = readdir(dp)) {
+    string h = ent->d_name;
+    if (h == "." || h == "..") continue;
+    string entry = string(ROOT)+"/"+h;
+    struct stat st;
+    if (h.size() != 16 || stat((entry+"/key").c_str(),&st)) { // unfinished
+      system("rm -rf %s",entry.c_str());
+      continue;
+    }
+    Entry& e = entries[h];
+    e.size = st.st_size;
+    e.used = st.st_mtime;
+    for (auto& f : files(entry+"/files")) {
+      if (!stat((entry+"/files/"+f.first).c_str(),&st)) e.size += st.st_size;
+    }
+    total += e.size;
+  }
+  closedir(dp);
+  evict();
+}
+
+int compile(const string& key, const string& cmd, const string& dir) {
+  if (max_size <= 0) return system(cmd.c_str());
+  string h = digest(key);
+  if (fetch(key,h,dir)) return 0;
+  auto before = files(dir);
+  int status = system(cmd.c_str());
+  if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+    return status; // failed, killed, or couldn't run: nothing to store
+  }
+  set<string> artifacts; // created or rewritten (when rerunning) by cmd
+  for (auto& f : files(dir)) {
+    auto it = before.find(f.first);
+    if (
+      it == before.end() ||
+      it->second.tv_sec != f.second.tv_sec ||
+      it->second.tv_nsec != f.second.tv_nsec
+    ) artifacts.insert(f.first);
+  }
+  store(key,h,dir,artifacts);
+  return status;
+}
+
+} // namespace Cache
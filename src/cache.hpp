@@ -0,0 +1,24 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <string>
+
+// compiled artifacts, kept in compile-cache/ and evicted least recently used
+// first once they take more than the configured size
+namespace Cache {
+
+void init(long long size); // bytes. 0 disables the cache
+
+// runs the compile command cmd in dir, unless the files it produced the last
+// time it ran for the same key are cached, in which case they are copied to
+// dir. key must hold everything that determines the result (source, command
+// template, problem and language). returns the exit status of cmd (0 if hit)
+int compile(
+  const std::string& key,
+  const std::string& cmd,
+  const std::string& dir
+);
+
+} // namespace Cache
+
+#endif
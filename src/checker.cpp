@@ -0,0 +1,259 @@
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "checker.hpp"
+
+#include "helper.hpp"
+
+using namespace std;
+
+namespace Checker {
+
+static inline bool space(char c) { // ' ', '\t', '\n', '\v', '\f' or '\r'
+  return c == ' ' || ('\t' <= c && c <= '\r');
+}
+
+// read-only file mapping
+struct Mapping {
+  const char* data;
+  size_t size;
+  bool ok;
+  Mapping(const string& fn) : data(nullptr), size(0), ok(false) {
+    int fd = open(fn.c_str(),O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd,&st) == 0) {
+      size = st.st_size;
+      if (size == 0) ok = true;
+      else {
+        void* mem = mmap(nullptr,size,PROT_READ,MAP_PRIVATE,fd,0);
+        if (mem != MAP_FAILED) {
+          madvise(mem,size,MADV_SEQUENTIAL);
+          data = (const char*)mem;
+          ok = true;
+        }
+      }
+    }
+    close(fd);
+  }
+  ~Mapping() {
+    if (data) munmap((void*)data,size);
+  }
+};
+
+// the bytes diff -wB looks at: non-space bytes of non-blank lines, each line
+// ended by a '\n'
+struct Cursor {
+  const char* p;
+  const char* end;
+  bool nonblank;
+  Cursor(const char* p, size_t n) : p(p), end(p+n), nonblank(false) {}
+  int next() { // -1 at the end
+    for (; p < end; p++) switch (*p) {
+      case '\n':
+        if (!nonblank) continue;
+        nonblank = false;
+        p++;
+        return '\n';
+      case ' ': case '\t': case '\v': case '\f': case '\r':
+        continue;
+      default:
+        nonblank = true;
+        return (unsigned char)*p++;
+    }
+    if (!nonblank) return -1;
+    nonblank = false; // last line has no '\n'
+    return '\n';
+  }
+};
+
+static bool write_all(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = ::write(fd,buf,len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+static int external(
+  const string& program,
+  const Launcher::Limits& limits,
+  const string& input,
+  const string& output,
+  const string& answer
+) {
+  int null = ::open("/dev/null",O_RDWR|O_CLOEXEC);
+  if (null < 0) return -1;
+  pid_t pid;
+  int handle = Launcher::spawn(
+    program+" "+input+" "+output+" "+answer,null,null,limits,pid
+  );
+  ::close(null);
+  Launcher::Result res;
+  if (handle < 0 || !Launcher::wait(handle,res)) return -1;
+  int st = res.status;
+  if (res.timeout || res.oom || !WIFEXITED(st)) return WA;
+  switch (WEXITSTATUS(st)) {
+    case 0: return AC;
+    case 2: return PE;
+  }
+  return WA;
+}
+
+static int confirm_pe(const string& output, const string& answer) {
+  // the non-blank lines match, but diff may still align a blank line with
+  // another one and report moved lines (e.g. "x\n\n" and "\nx\n"). this
+  // is rare, so let diff decide
+  int status = system(
+    "diff -wB %s %s > /dev/null",
+    output.c_str(),
+    answer.c_str()
+  );
+  return WEXITSTATUS(status) ? WA : PE;
+}
+
+Stream::Stream(
+  const JSON& checker,
+  const string& input,
+  const string& answer,
+  const string& spool,
+  const Launcher::Limits& limits
+) :
+type(DIFF), epsilon(1e-6), limits(limits), input(input), answer(answer),
+spool(spool), expected(new Mapping(answer)), cursor(nullptr), pos(0),
+exact(true), nonblank(false), wrong(!expected->ok), fd(-1) {
+  JSON tp = (checker.isobj() ? checker("type") : checker);
+  if (tp == "tokens") type = TOKENS;
+  else if (tp == "float") type = FLOAT;
+  else if (tp == "external") type = EXTERNAL;
+  if (type == FLOAT) epsilon = checker("epsilon").to(epsilon);
+  if (type == EXTERNAL) {
+    program = checker("path").str();
+    fd = ::open(spool.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+    wrong = (fd < 0);
+  }
+  cursor = new Cursor(expected->data,expected->size);
+}
+
+Stream::~Stream() {
+  if (fd >= 0) ::close(fd);
+  delete cursor;
+  delete expected;
+}
+
+bool Stream::write(const char* buf, size_t len) {
+  if (wrong) return false;
+  switch (type) {
+    case TOKENS: case FLOAT:
+      return feed_tokens(buf,buf+len);
+    case EXTERNAL:
+      return write_all(fd,buf,len);
+  }
+  if (exact) { // fast path
+    size_t n = min(len,expected->size-pos);
+    if (n == len && (!n || !memcmp(buf,expected->data+pos,n))) {
+      pos += n;
+      return true;
+    }
+    if (!diverge()) return false;
+  }
+  if (fd >= 0) write_all(fd,buf,len);
+  return feed(buf,buf+len);
+}
+
+int Stream::close() {
+  if (wrong) return WA;
+  switch (type) {
+    case TOKENS: case FLOAT:
+      if (!token.empty() && !compare_token()) return WA;
+      for (const char* p = cursor->p; p < cursor->end; p++) {
+        if (!space(*p)) return WA;
+      }
+      return AC;
+    case EXTERNAL:
+      ::close(fd);
+      fd = -1;
+      return external(program,limits,input,spool,answer);
+  }
+  if (exact && pos == expected->size) return AC;
+  if (exact && !diverge()) return WA;
+  if (nonblank && !compare('\n')) return WA; // last line has no '\n'
+  nonblank = false;
+  if (cursor->next() >= 0) return WA;
+  ::close(fd);
+  fd = -1;
+  return confirm_pe(spool,answer);
+}
+
+bool Stream::diverge() { // leave the fast path
+  exact = false;
+  fd = ::open(spool.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+  if (fd >= 0 && pos > 0) ::write(fd,expected->data,pos);
+  return feed(expected->data,expected->data+pos);
+}
+
+bool Stream::feed(const char* p, const char* end) {
+  for (; p < end; p++) switch (*p) {
+    case '\n':
+      if (nonblank && !compare('\n')) return false;
+      nonblank = false;
+      break;
+    case ' ': case '\t': case '\v': case '\f': case '\r':
+      break;
+    default:
+      nonblank = true;
+      if (!compare((unsigned char)*p)) return false;
+  }
+  return true;
+}
+
+bool Stream::compare(int c) {
+  if (cursor->next() == c) return true;
+  wrong = true;
+  return false;
+}
+
+bool Stream::feed_tokens(const char* p, const char* end) {
+  while (p < end) {
+    const char* q = p;
+    while (q < end && !space(*q)) q++;
+    token.append(p,q);
+    if (q == end) break;
+    if (!token.empty() && !compare_token()) return false;
+    for (p = q; p < end && space(*p); p++);
+  }
+  return true;
+}
+
+bool Stream::compare_token() { // the answer's tokens are read in place
+  const char*& p = cursor->p;
+  while (p < cursor->end && space(*p)) p++;
+  const char* q = p;
+  while (q < cursor->end && !space(*q)) q++;
+  string tmp(p,q);
+  p = q;
+  bool ok = (tmp == token);
+  if (!ok && type == FLOAT) {
+    char *e1, *e2;
+    double x = strtod(token.c_str(),&e1), y = strtod(tmp.c_str(),&e2);
+    ok =
+      !tmp.empty() && !*e1 && !*e2 &&
+      (fabs(x-y) <= epsilon || fabs(x-y) <= epsilon*fabs(y))
+    ;
+  }
+  token.clear();
+  if (!ok) wrong = true;
+  return ok;
+}
+
+} // namespace Checker
@@ -0,0 +1,61 @@
+#ifndef CHECKER_H
+#define CHECKER_H
+
+#include <string>
+
+#include "json.hpp"
+#include "launcher.hpp"
+
+namespace Checker {
+
+struct Mapping; // hidden class for implementation
+struct Cursor; // hidden class for implementation
+
+// checks an output that is still being written, as configured by the
+// problem's "checker" setting:
+//   absent or "diff": same verdicts as running diff -wB (WA) and then diff
+//     (PE). the output is spooled to a file only after it stops matching the
+//     answer byte by byte, since diff -wB may still be needed to tell PE from
+//     WA
+//   "tokens": whitespace separated tokens must be equal
+//   {"type": "float", "epsilon": e}: like "tokens", but numbers may differ by
+//     an absolute or relative error of e (default 1e-6)
+//   {"type": "external", "path": p, "timelimit": t}: the whole output is
+//     spooled and then "p input output answer" is run by the launcher, with
+//     the given limits. exit status 0 means AC, 2 means PE and anything else
+//     (or being killed) means WA
+class Stream {
+  public:
+    Stream(
+      const JSON& checker,
+      const std::string& input,
+      const std::string& answer,
+      const std::string& spool,
+      const Launcher::Limits& limits // of an external checker
+    );
+    ~Stream();
+    bool write(const char* buf, size_t len); // false: wrong answer, stop
+    int close(); // AC, PE, WA, or -1 if an external checker couldn't run
+  private:
+    enum {DIFF = 0, TOKENS, FLOAT, EXTERNAL};
+    int type;
+    double epsilon;
+    std::string program;
+    Launcher::Limits limits;
+    std::string input, answer, spool;
+    Mapping* expected;
+    Cursor* cursor;
+    size_t pos; // DIFF: output bytes matching the answer byte by byte
+    bool exact, nonblank, wrong;
+    std::string token; // TOKENS and FLOAT: incomplete output token
+    int fd;
+    bool diverge();
+    bool feed(const char* p, const char* end);
+    bool compare(int c);
+    bool feed_tokens(const char* p, const char* end);
+    bool compare_token();
+};
+
+} // namespace Checker
+
+#endif
@@ -1,4 +1,5 @@
 #include <cmath>
+#include <climits>
 #include <algorithm>
 
 #include "contest.hpp"
@@ -7,6 +8,7 @@
 #include "problem.hpp"
 #include "attempt.hpp"
 #include "user.hpp"
+#include "scoreboard.hpp"
 
 using namespace std;
 
@@ -193,30 +195,24 @@ JSON scoreboard(int id, int user) {
   if (!contest) return contest;
   JSON ans(map<string,JSON>{
     {"status"   , contest("finished") ? "final" : ""},
-    {"attempts" , JSON()},
     {"colors"   , vector<JSON>{}}
   });
   // get problem info
   JSON probs = list_problems(contest,user);
-  map<int,int> idx;
+  vector<int> pids;
   for (auto& prob : probs.arr()) {
-    idx[prob["id"]] = ans["colors"].size();
+    pids.push_back(prob["id"]);
     ans["colors"].push_back(prob["color"]);
   }
-  // get attempts
-  ans["attempts"] = Attempt::page(user,0,0,id,true);
-  // set info
-  auto& arr = ans["attempts"].arr();
-  for (auto& att : arr) {
-    att["problem"] = idx[att["problem"]["id"]];
-    att["user"] = User::name(att["user"]);
-  }
   // no freeze/blind filtering needed?
   if (
     contest("finished") ||
     (int(contest["freeze"]) == 0 && int(contest["blind"]) == 0) ||
     isjudge(user,contest)
-  ) return ans;
+  ) {
+    ans["teams"] = Scoreboard::get(id,pids,INT_MAX);
+    return ans;
+  }
   // freeze/blind filtering
   int freeze = int(contest["duration"])-int(contest["freeze"]);
   int blind = int(contest["duration"])-int(contest["blind"]);
@@ -224,11 +220,7 @@ JSON scoreboard(int id, int user) {
   time_t frz = begin(contest) + 60*freeze;
   if (frz <= ::time(nullptr)) ans["status"] = "frozen";
   ans["freeze"] = freeze;
-  JSON tmp(vector<JSON>{});
-  for (auto& att : arr) if (int(att["contest_time"]) < freeze) {
-    tmp.push_back(move(att));
-  }
-  ans["attempts"] = move(tmp);
+  ans["teams"] = Scoreboard::get(id,pids,freeze);
   return ans;
 }
 
@@ -1,6 +1,15 @@
 #include <map>
+#include <set>
+#include <memory>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "database.hpp"
 
@@ -8,151 +17,544 @@
 
 #define MAX_COLLECTIONS 100
 #define WRITE_INTERVAL  30
+#define COMPACT_SIZE    (1<<20) // log bytes that trigger a new snapshot
+#define SNAP_MAGIC      0x42444a50u // "PJDB"
+#define SNAP_VERSION    1u
 
 using namespace std;
 
 static int backup = -1;
 
-struct Coll {
+// documents are immutable once stored, so readers and snapshots share them by
+// pointer. writers build a new document and swap the pointer
+typedef shared_ptr<const JSON> Doc;
+
+static bool write_all(int fd, const string& data) {
+  for (size_t i = 0; i < data.size();) {
+    ssize_t sysret = ::write(fd,data.c_str()+i,data.size()-i);
+    if (sysret < 0) return false;
+    i += sysret;
+  }
+  return true;
+}
+
+// binary snapshots: magic, version and document count, followed by each
+// document id and the length-prefixed encoding of the document
+template <typename T>
+static void put(string& out, T x) {
+  out.append((const char*)&x,sizeof x);
+}
+static void encode(const JSON& val, string& out) {
+  if (val.isobj()) {
+    out += 'o'; put<uint32_t>(out,val.size());
+    for (auto& kv : val.obj()) {
+      put<uint32_t>(out,kv.first.size());
+      out += kv.first;
+      encode(kv.second,out);
+    }
+  }
+  else if (val.isarr()) {
+    out += 'a'; put<uint32_t>(out,val.size());
+    for (auto& x : val.arr()) encode(x,out);
+  }
+  else {
+    out += 's'; put<uint32_t>(out,val.str().size());
+    out += val.str();
+  }
+}
+struct Reader {
+  const char* p;
+  const char* end;
+  template <typename T>
+  bool get(T& x) {
+    if (size_t(end-p) < sizeof x) return false;
+    memcpy(&x,p,sizeof x);
+    p += sizeof x;
+    return true;
+  }
+  bool get(string& x, uint32_t len) {
+    if (size_t(end-p) < len) return false;
+    x.assign(p,len);
+    p += len;
+    return true;
+  }
+};
+static bool decode(Reader& r, JSON& val) {
+  char tag;
+  uint32_t n;
+  string key;
+  if (!r.get(tag) || !r.get(n)) return false;
+  switch (tag) {
+    case 's':
+      if (!r.get(key,n)) return false;
+      val = move(key);
+      return true;
+    case 'o':
+      val = JSON();
+      for (uint32_t i = 0; i < n; i++) {
+        uint32_t len;
+        if (!r.get(len) || !r.get(key,len)) return false;
+        if (!decode(r,val[key])) return false;
+      }
+      return true;
+    case 'a':
+      if (size_t(r.end-r.p) < n) return false; // one byte per value, at least
+      val = vector<JSON>(n);
+      for (auto& x : val.arr()) if (!decode(r,x)) return false;
+      return true;
+  }
+  return false;
+}
+static bool write_snapshot(const string& fn, cmap<int,Doc>& docs) {
+  string out, doc;
+  put<uint32_t>(out,SNAP_MAGIC);
+  put<uint32_t>(out,SNAP_VERSION);
+  put<uint64_t>(out,docs.size());
+  for (auto& kv : docs) {
+    doc.clear();
+    encode(*kv.second,doc);
+    put<int32_t>(out,kv.first);
+    put<uint32_t>(out,doc.size());
+    out += doc;
+  }
+  int fd = ::open(fn.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+  if (fd < 0) return false;
+  bool ok = write_all(fd,out) && fsync(fd) == 0;
+  ::close(fd);
+  return ok;
+}
+static bool read_snapshot(const string& fn, cmap<int,Doc>& docs) {
+  int fd = ::open(fn.c_str(),O_RDONLY|O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat st;
+  void* mem = MAP_FAILED;
+  if (fstat(fd,&st) == 0 && st.st_size > 0) {
+    mem = mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  }
+  ::close(fd);
+  if (mem == MAP_FAILED) return false;
+  JSON val;
+  Reader r{(const char*)mem,(const char*)mem+st.st_size};
+  uint32_t magic, version;
+  uint64_t n;
+  bool ok =
+    r.get(magic) && magic == SNAP_MAGIC &&
+    r.get(version) && version == SNAP_VERSION &&
+    r.get(n)
+  ;
+  for (uint64_t i = 0; ok && i < n; i++) {
+    int32_t id;
+    uint32_t len;
+    ok = r.get(id) && r.get(len) && size_t(r.end-r.p) >= len;
+    if (!ok) break;
+    Reader doc{r.p,r.p+len};
+    ok = decode(doc,val) && doc.p == doc.end;
+    docs[id] = make_shared<const JSON>(move(val));
+    r.p += len;
+  }
+  munmap(mem,st.st_size);
+  return ok;
+}
+
+// write-ahead log. each line is a JSON record with a whole document (put) or
+// a deletion (del), so replaying old records over a newer snapshot is harmless
+struct Log {
+  int fd;
+  string pending; // records not written yet
+  uint64_t appended, durable; // record counters
+  size_t size; // bytes appended since last rotation
+  bool flushing;
   pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  Log() :
+  fd(-1), appended(0), durable(0), size(0), flushing(false),
+  mutex(PTHREAD_MUTEX_INITIALIZER), cond(PTHREAD_COND_INITIALIZER) {}
+  void open(const string& fn) {
+    fd = ::open(fn.c_str(),O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,0644);
+    struct stat st;
+    size = (fstat(fd,&st) == 0 ? st.st_size : 0);
+  }
+  uint64_t append(const JSON& rec) { // called with the collection locked
+    string line = move(rec.generate()+"\n");
+    pthread_mutex_lock(&mutex);
+    pending += line;
+    size += line.size();
+    uint64_t lsn = ++appended;
+    pthread_mutex_unlock(&mutex);
+    return lsn;
+  }
+  uint64_t put(int id, const JSON& doc) {
+    return append(map<string,JSON>{
+      {"op"       , "put"},
+      {"_id"      , id},
+      {"document" , doc}
+    });
+  }
+  uint64_t del(int id) {
+    return append(map<string,JSON>{{"op","del"},{"_id",id}});
+  }
+  // group commit: one fdatasync() for many records. false if the records up to
+  // lsn could not be made durable. then they are put back to be retried by
+  // the next commit, and what was written of them is truncated away, so no
+  // torn record is left before them in the log
+  bool commit(uint64_t lsn) {
+    bool ok = true;
+    pthread_mutex_lock(&mutex);
+    while (ok && durable < lsn) {
+      if (flushing) { pthread_cond_wait(&cond,&mutex); continue; }
+      flushing = true;
+      string batch;
+      batch.swap(pending);
+      uint64_t upto = appended;
+      pthread_mutex_unlock(&mutex);
+      off_t end = lseek(fd,0,SEEK_END);
+      ok = end >= 0 && write_all(fd,batch) && fdatasync(fd) == 0;
+      if (!ok && end >= 0) ftruncate(fd,end);
+      pthread_mutex_lock(&mutex);
+      flushing = false;
+      if (ok) durable = upto;
+      else pending.insert(0,batch);
+      pthread_cond_broadcast(&cond);
+    }
+    pthread_mutex_unlock(&mutex);
+    return ok;
+  }
+  bool rotate(const string& fn) { // called with the collection locked
+    if (!commit(appended)) return false;
+    pthread_mutex_lock(&mutex);
+    ::close(fd);
+    rename(fn.c_str(),(fn+".old").c_str());
+    open(fn);
+    pthread_mutex_unlock(&mutex);
+    return true;
+  }
+  static void replay(const string& fn, cmap<int,Doc>& documents) {
+    ifstream f(fn.c_str());
+    JSON rec;
+    for (string line; getline(f,line);) {
+      if (!rec.parse(line)) break; // torn write at the end of the log
+      if (rec("op") == "put") {
+        documents[rec("_id")] = make_shared<const JSON>(rec("document"));
+      }
+      else documents.erase(int(rec("_id")));
+    }
+  }
+};
+
+// secondary indexes: collection -> indexed fields (scalar values only)
+static const map<string,vector<string>> indexed = {
+  {"attempts" , {"contest","status","user"}},
+  {"users"    , {"username"}}
+};
+
+struct Coll {
+  pthread_rwlock_t rwlock; // readers share, writers exclude
   string name;
-  cmap<int,JSON> documents;
-  Coll() : mutex(PTHREAD_MUTEX_INITIALIZER) {}
+  cmap<int,Doc> documents;
+  map<string,map<string,set<int>>> index; // field -> value -> ids
+  Log log;
+  Coll() { // readers come steadily: don't let them starve the writers
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(
+      &attr,PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
+    );
+    pthread_rwlock_init(&rwlock,&attr);
+    pthread_rwlockattr_destroy(&attr);
+  }
+  ~Coll() {
+    pthread_rwlock_destroy(&rwlock);
+  }
+  string path(const string& ext) const {
+    return "database/"+name+ext;
+  }
   void read() { // this function is called only once, by a locked piece of code
+    string snap = path(".snap");
+    if (!read_snapshot(snap,documents)) { // JSON from humans
+      // the JSON is older than a snapshot that exists: never fall back on it
+      if (access(snap.c_str(),F_OK) == 0) {
+        fprintf(stderr,"pjudge: %s is corrupt.\n",snap.c_str());
+        _exit(-1);
+      }
+      documents.clear();
+      read_json(documents);
+    }
+    bool compacting = (access(path(".wal.old").c_str(),F_OK) == 0);
+    Log::replay(path(".wal.old"),documents);
+    Log::replay(path(".wal"),documents);
+    log.open(path(".wal"));
+    if (compacting) save(documents); // last compaction didn't finish
+    auto it = indexed.find(name);
+    if (it != indexed.end()) for (auto& field : it->second) index[field];
+    for (auto& kv : documents) reindex(kv.first,*kv.second,true);
+  }
+  void reindex(int id, const JSON& doc, bool add) {
+    if (!doc.isobj()) return;
+    for (auto& idx : index) {
+      auto it = doc.find(idx.first);
+      if (it == doc.obj().end() || !it->second.isstr()) continue;
+      if (add) idx.second[it->second.str()].insert(id);
+      else {
+        auto jt = idx.second.find(it->second.str());
+        if (jt == idx.second.end()) continue;
+        jt->second.erase(id);
+        if (jt->second.empty()) idx.second.erase(jt);
+      }
+    }
+  }
+  const set<int>* candidates(const JSON& filter) { // nullptr: full scan
+    static const set<int> none;
+    const set<int>* ans = nullptr;
+    if (!filter.isobj()) return ans;
+    for (auto& kv : filter.obj()) {
+      auto it = index.find(kv.first);
+      if (it == index.end() || !kv.second.isstr()) continue;
+      auto jt = it->second.find(kv.second.str());
+      if (jt == it->second.end()) return &none;
+      if (!ans || jt->second.size() < ans->size()) ans = &jt->second;
+    }
+    return ans;
+  }
+  void read_json(cmap<int,Doc>& docs) {
     JSON tmp;
-    if (!tmp.read_file("database/"+name+".json")) return;
-    for (auto& doc : tmp.arr()) documents[doc("_id")] = doc("document");
+    if (!tmp.read_file(path(".json"))) return;
+    for (auto& doc : tmp.arr()) {
+      docs[doc("_id")] = make_shared<const JSON>(doc("document"));
+    }
   }
-  void write() {
+  void write_json() {
     JSON tmp(vector<JSON>{});
-    pthread_mutex_lock(&mutex);
-    for (auto& kv : documents) tmp.emplace_back(move(map<string,JSON>{
+    pthread_rwlock_rdlock(&rwlock);
+    cmap<int,Doc> docs = documents;
+    pthread_rwlock_unlock(&rwlock);
+    for (auto& kv : docs) tmp.emplace_back(move(map<string,JSON>{
       {"_id"      , kv.first},
-      {"document" , kv.second}
+      {"document" , *kv.second}
     }));
-    pthread_mutex_unlock(&mutex);
-    tmp.write_file("database/"+name+".json");
+    tmp.write_file(path(".json"));
+  }
+  bool save(cmap<int,Doc>& docs) { // snapshot, then drop the rotated log
+    string fn = path(".snap");
+    if (!write_snapshot(fn+".tmp",docs)) return false;
+    rename((fn+".tmp").c_str(),fn.c_str());
+    int fd = ::open("database",O_RDONLY|O_CLOEXEC);
+    fsync(fd);
+    ::close(fd);
+    remove(path(".wal.old").c_str());
+    return true;
+  }
+  bool compact(bool force) {
+    // if the last snapshot failed, the rotated log still holds records it
+    // lacks: don't rotate over it, just try the snapshot again (the current
+    // log is replayed harmlessly over it)
+    bool retry = (access(path(".wal.old").c_str(),F_OK) == 0);
+    pthread_mutex_lock(&log.mutex);
+    size_t size = log.size;
+    pthread_mutex_unlock(&log.mutex);
+    if (!retry && (size == 0 || (!force && size < COMPACT_SIZE))) return false;
+    pthread_rwlock_rdlock(&rwlock); // enough to keep writers off the log
+    cmap<int,Doc> copy = documents; // pointers only
+    bool rotated = !retry && log.rotate(path(".wal"));
+    pthread_rwlock_unlock(&rwlock);
+    if (!retry && !rotated) return false;
+    return save(copy);
   }
   int create(JSON&& doc) {
+    Doc ptr = make_shared<const JSON>(move(doc));
     int id = 1;
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&rwlock);
     if (documents.size() > 0) id += documents.max_key();
-    documents[id] = move(doc);
-    pthread_mutex_unlock(&mutex);
-    return id;
+    documents[id] = ptr;
+    reindex(id,*ptr,true);
+    uint64_t lsn = log.put(id,*ptr);
+    pthread_rwlock_unlock(&rwlock);
+    return log.commit(lsn) ? id : 0;
   }
   bool retrieve(int id, JSON& doc) {
-    pthread_mutex_lock(&mutex);
+    Doc ptr;
+    pthread_rwlock_rdlock(&rwlock);
     auto it = documents.find(id);
-    if (it == documents.end()) {
+    if (it != documents.end()) ptr = it->second;
+    pthread_rwlock_unlock(&rwlock);
+    if (!ptr) {
       doc.setnull();
-      pthread_mutex_unlock(&mutex);
       return false;
     }
-    doc = it->second;
-    pthread_mutex_unlock(&mutex);
+    doc = *ptr;
     return true;
   }
+  // the lock is only held to collect pointers. filtering and copying the
+  // documents out is done on the collected ones
   JSON retrieve(const JSON& filter) {
+    vector<pair<int,Doc>> docs;
+    pthread_rwlock_rdlock(&rwlock);
+    auto ids = candidates(filter);
+    if (ids) for (int id : *ids) {
+      docs.emplace_back(id,documents.find(id)->second);
+    }
+    else for (auto& kv : documents) docs.emplace_back(kv.first,kv.second);
+    pthread_rwlock_unlock(&rwlock);
     JSON ans(vector<JSON>{});
-    pthread_mutex_lock(&mutex);
-    for (auto& kv : documents) if (filter.issubobj(kv.second)) {
-      JSON tmp = kv.second;
-      tmp["id"] = kv.first;
+    for (auto& doc : docs) if (filter.issubobj(*doc.second)) {
+      JSON tmp = *doc.second;
+      tmp["id"] = doc.first;
       ans.push_back(move(tmp));
     }
-    pthread_mutex_unlock(&mutex);
     return ans;
   }
   JSON retrieve_page(unsigned p, unsigned ps) {
-    JSON ans(vector<JSON>{});
-    pthread_mutex_lock(&mutex);
+    vector<pair<int,Doc>> docs;
+    pthread_rwlock_rdlock(&rwlock);
     if (!ps) p = 0, ps = documents.size();
     auto it = documents.at(p*ps);
     for (int i = 0; i < ps && it != documents.end(); i++, it++) {
-      JSON tmp = it->second;
-      tmp["id"] = it->first;
+      docs.emplace_back(it->first,it->second);
+    }
+    pthread_rwlock_unlock(&rwlock);
+    JSON ans(vector<JSON>{});
+    for (auto& doc : docs) {
+      JSON tmp = *doc.second;
+      tmp["id"] = doc.first;
       ans.push_back(move(tmp));
     }
-    pthread_mutex_unlock(&mutex);
     return ans;
   }
   bool update(int id, JSON&& doc) {
-    pthread_mutex_lock(&mutex);
+    Doc ptr = make_shared<const JSON>(move(doc));
+    pthread_rwlock_wrlock(&rwlock);
     auto it = documents.find(id);
     if (it == documents.end()) {
-      pthread_mutex_unlock(&mutex);
+      pthread_rwlock_unlock(&rwlock);
       return false;
     }
-    it->second = move(doc);
-    pthread_mutex_unlock(&mutex);
-    return true;
+    reindex(id,*it->second,false);
+    it->second.swap(ptr);
+    reindex(id,*it->second,true);
+    uint64_t lsn = log.put(id,*it->second);
+    pthread_rwlock_unlock(&rwlock);
+    return log.commit(lsn); // the old document is released out of the lock
+  }
+  // upd works on a copy made out of the lock, which replaces the stored
+  // document if upd returns true. if someone else replaced it meanwhile, upd
+  // runs again on the new one
+  bool update(const Database::Updater& upd, int id, Doc ptr, uint64_t& lsn) {
+    for (;;) {
+      Database::Document doc(id,*ptr);
+      if (!upd(doc)) return false;
+      Doc next = make_shared<const JSON>(move(doc.second));
+      pthread_rwlock_wrlock(&rwlock);
+      auto it = documents.find(id);
+      bool found = (it != documents.end()), same = found && it->second == ptr;
+      if (same) {
+        reindex(id,*ptr,false);
+        it->second = next;
+        reindex(id,*next,true);
+        lsn = log.put(id,*next);
+      }
+      else if (found) ptr = it->second;
+      pthread_rwlock_unlock(&rwlock);
+      if (same || !found) return same;
+    }
   }
   bool update(const Database::Updater& upd, int id) {
-    bool ans = false;
-    pthread_mutex_lock(&mutex);
+    vector<pair<int,Doc>> docs;
+    pthread_rwlock_rdlock(&rwlock);
     auto it = documents.find(id);
-    if (it != documents.end()) {
-      ans = upd(*it);
-      pthread_mutex_unlock(&mutex);
-      return ans;
-    }
-    for (auto& kv : documents) ans = upd(kv) || ans;
-    pthread_mutex_unlock(&mutex);
-    return ans;
+    if (it != documents.end()) docs.emplace_back(id,it->second);
+    else for (auto& kv : documents) docs.emplace_back(kv.first,kv.second);
+    pthread_rwlock_unlock(&rwlock);
+    bool ans = false;
+    uint64_t lsn = 0;
+    for (auto& doc : docs) ans = update(upd,doc.first,doc.second,lsn) || ans;
+    return log.commit(lsn) && ans;
   }
   bool destroy(int id) {
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&rwlock);
     auto it = documents.find(id);
     if (it == documents.end()) {
-      pthread_mutex_unlock(&mutex);
+      pthread_rwlock_unlock(&rwlock);
       return false;
     }
+    reindex(id,*it->second,false);
     documents.erase(it);
-    pthread_mutex_unlock(&mutex);
-    return true;
+    uint64_t lsn = log.del(id);
+    pthread_rwlock_unlock(&rwlock);
+    return log.commit(lsn);
   }
 };
 static Coll collection[MAX_COLLECTIONS];
 static int ncolls = 0;
-static pthread_mutex_t colls_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t colls_rwlock = PTHREAD_RWLOCK_INITIALIZER;
 static int get(const string& name) {
   static map<string,int> colls;
   int i;
-  pthread_mutex_lock(&colls_mutex);
+  pthread_rwlock_rdlock(&colls_rwlock);
   auto it = colls.find(name);
+  i = (it != colls.end() ? it->second : -1);
+  pthread_rwlock_unlock(&colls_rwlock);
+  if (i >= 0) return i;
+  pthread_rwlock_wrlock(&colls_rwlock);
+  it = colls.find(name);
   if (it != colls.end()) {
     i = it->second;
-    pthread_mutex_unlock(&colls_mutex);
+    pthread_rwlock_unlock(&colls_rwlock);
     return i;
   }
   i = ncolls++;
-  colls[name] = i;
   collection[i].name = name;
   collection[i].read();
-  pthread_mutex_unlock(&colls_mutex);
+  colls[name] = i;
+  pthread_rwlock_unlock(&colls_rwlock);
   return i;
 }
 
 // thread
 static bool quit = false;
 static pthread_t db;
-static void do_backup() {
+static void copy_file(const string& src, const string& dst) {
+  remove(dst.c_str());
+  ifstream in(src.c_str(),ios::binary);
+  if (in) ofstream(dst.c_str(),ios::binary) << in.rdbuf();
+}
+// snapshots are never rewritten: hard links. logs keep growing, so they are
+// copied (with a torn record at the end at most, which replay ignores). this
+// thread is the only one that rotates logs, so each snapshot matches its logs
+static void do_backup(int nc) {
   if (backup < 0) return;
   stringstream ss;
-  ss << "backup" << backup;
-  system(("mkdir -p database/"+ss.str()).c_str());
-  system(("cp database/*.json database/"+ss.str()).c_str());
+  ss << "database/backup" << backup;
+  mkdir(ss.str().c_str(),0755);
+  for (int i = 0; i < nc; i++) {
+    string dst = ss.str()+"/"+collection[i].name;
+    remove((dst+".snap").c_str());
+    link(collection[i].path(".snap").c_str(),(dst+".snap").c_str());
+    copy_file(collection[i].path(".wal.old"),dst+".wal.old");
+    copy_file(collection[i].path(".wal"),dst+".wal");
+  }
   backup = 1-backup;
 }
-static void update() {
+static void update(bool force = false) {
   int nc;
-  pthread_mutex_lock(&colls_mutex);
+  pthread_rwlock_rdlock(&colls_rwlock);
   nc = ncolls;
-  pthread_mutex_unlock(&colls_mutex);
-  for (int i = 0; i < nc; i++) collection[i].write();
-  do_backup();
-  sync();
+  pthread_rwlock_unlock(&colls_rwlock);
+  for (int i = 0; i < nc; i++) collection[i].compact(force);
+  do_backup(nc); // every time: the logs keep what wasn't compacted yet
+}
+static set<string> names() { // collections found in database/
+  set<string> ans;
+  DIR* dir = opendir("database");
+  if (!dir) return ans;
+  for (dirent* ent = readdir(dir); ent; ent = readdir(dir)) {
+    string fn = ent->d_name;
+    for (string ext : {".snap",".json",".wal"}) {
+      if (fn.size() <= ext.size()) continue;
+      if (fn.compare(fn.size()-ext.size(),ext.size(),ext)) continue;
+      ans.insert(fn.substr(0,fn.size()-ext.size()));
+    }
+  }
+  closedir(dir);
+  return ans;
 }
 static void* thread(void*) {
   static time_t upd = 0;
@@ -224,7 +626,37 @@ void init(bool backup) {
 void close() {
   quit = true;
   pthread_join(db,nullptr);
-  update();
+  update(true);
+}
+
+vector<string> corrupt() {
+  vector<string> ans;
+  for (auto& name : names()) {
+    Coll tmp;
+    tmp.name = name;
+    cmap<int,Doc> docs;
+    string snap = tmp.path(".snap");
+    if (access(snap.c_str(),F_OK) == 0 && !read_snapshot(snap,docs)) {
+      ans.push_back(snap);
+    }
+  }
+  return ans;
+}
+
+void export_json() {
+  for (auto& name : names()) collection[get(name)].write_json();
+}
+
+void import_json() {
+  for (auto& name : names()) {
+    Coll tmp;
+    tmp.name = name;
+    cmap<int,Doc> docs;
+    if (access(tmp.path(".json").c_str(),F_OK)) continue;
+    tmp.read_json(docs);
+    if (!tmp.save(docs)) continue;
+    remove(tmp.path(".wal").c_str());
+  }
 }
 
 } // namespace Database
@@ -13,6 +13,8 @@ typedef std::pair<const int,JSON> Document;
 typedef std::function<bool(Document&)> Updater;
 inline Document null() { return Document(0,JSON::null()); }
 
+// writes return 0 (create) or false if the change could not be made durable.
+// it is still visible, and written to the log again by the next write
 class Collection {
   // API
   public:
@@ -25,7 +27,9 @@ class Collection {
     JSON retrieve_page(unsigned page, unsigned page_size);
     bool update(int docid, const JSON& document);
     bool update(int docid, JSON&& document);
-    bool update(const Updater&, int docid = 0); // care for deadlocks!
+    // the updater works on a copy, with the collection unlocked, and may run
+    // more than once for a document written by someone else meanwhile
+    bool update(const Updater&, int docid = 0);
     bool destroy(int docid);
   // implementation
   private:
@@ -34,6 +38,9 @@ class Collection {
 
 void init(bool backup);
 void close();
+std::vector<std::string> corrupt(); // snapshots that can't be read
+void export_json(); // writes database/<name>.json for every collection
+void import_json(); // replaces collections by database/<name>.json files
 
 } // namespace Database
 
@@ -7,6 +7,7 @@
 #include "database.hpp"
 #include "message.hpp"
 #include "judge.hpp"
+#include "launcher.hpp"
 #include "webserver.hpp"
 #include "contest.hpp"
 #include "attempt.hpp"
@@ -98,6 +99,17 @@ void start() {
     "next execution will be fine.\n",
     getcwd().c_str()
   );
+  auto corrupt = Database::corrupt();
+  if (corrupt.size()) {
+    printf("pjudge[%s] could not start. corrupt snapshots:\n",getcwd().c_str());
+    for (auto& fn : corrupt) printf("  %s\n",fn.c_str());
+    printf(
+      "\n"
+      "FIX: restore them (and their logs) from a database backup, or remove\n"
+      "them to load the JSON files instead, losing what they had since.\n"
+    );
+    exit(-1);
+  }
   printf("pjudge[%s] started.\n",getcwd().c_str());
   if (daemon(1,0) < 0) { // fork and redirect IO to /dev/null
     perror(stringf(
@@ -106,6 +118,7 @@ void start() {
     ).c_str());
     _exit(-1);
   }
+  Launcher::init(); // fork it while we are small and single-threaded
   pjudge pj; // RAII
   signal(SIGTERM,term); // Global::shutdown();
   signal(SIGPIPE,SIG_IGN); // ignore broken pipes (tcp shit)
@@ -120,9 +133,22 @@ void start() {
   }
   WebServer::close();
   Judge::close();
+  Launcher::close();
   Database::close();
 }
 
+void export_database() {
+  offline();
+  Database::export_json();
+  printf("pjudge[%s] database exported to JSON.\n",getcwd().c_str());
+}
+
+void import_database() {
+  offline();
+  Database::import_json();
+  printf("pjudge[%s] database imported from JSON.\n",getcwd().c_str());
+}
+
 void stop() {
   key_t key = online();
   Message(STOP).send(key);
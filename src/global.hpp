@@ -8,6 +8,8 @@ namespace Global {
 void install(const std::string& path);
 void start();
 void stop();
+void export_database();
+void import_database();
 void rerun_attempt(int id);
 
 void shutdown();
@@ -1,14 +1,24 @@
+#include <cerrno>
 #include <cstring>
 #include <fstream>
 #include <queue>
 #include <list>
+#include <set>
 #include <algorithm>
+#include <memory>
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
 #include <semaphore.h>
 #include <netinet/in.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <zlib.h>
 
 #include "httpserver.hpp"
 
@@ -103,6 +113,67 @@ inline T setting(T def, Args... args) {
   return settings(args...).to(def);
 }
 
+// reactor
+static int epfd = -1, wakefd = -1;
+static char listen_tag, wake_tag, notify_tag; // non-client descriptors
+static set<pair<time_t,HTTP::Handler*>> deadlines;
+static map<HTTP::Handler*,time_t> deadline;
+static pthread_mutex_t reactor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void watch(HTTP::Handler* handler, bool rearm = true) {
+  static const time_t request_timeout = setting(0,"request","timeout");
+  static const time_t idle_timeout = setting(5,"keep_alive","timeout");
+  time_t timeout = (handler->idle() ? idle_timeout : request_timeout);
+  bool wake = false;
+  epoll_event ev;
+  memset(&ev,0,sizeof ev);
+  ev.events = EPOLLIN|EPOLLRDHUP|EPOLLONESHOT;
+  ev.data.ptr = handler;
+  pthread_mutex_lock(&reactor_mutex);
+  if (timeout) {
+    time_t end = time(nullptr)+timeout;
+    wake = deadlines.empty(); // reactor may be blocked without a timeout
+    deadline[handler] = end;
+    deadlines.emplace(end,handler);
+  }
+  epoll_ctl(epfd,rearm ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,handler->socket(),&ev);
+  pthread_mutex_unlock(&reactor_mutex);
+  if (wake && rearm) HTTP::interrupt();
+}
+static void unwatch(HTTP::Handler* handler) {
+  pthread_mutex_lock(&reactor_mutex);
+  auto it = deadline.find(handler);
+  if (it != deadline.end()) {
+    deadlines.erase(make_pair(it->second,handler));
+    deadline.erase(it);
+  }
+  pthread_mutex_unlock(&reactor_mutex);
+}
+static HTTP::Handler* expired() { // pops one expired connection, if any
+  HTTP::Handler* ans = nullptr;
+  pthread_mutex_lock(&reactor_mutex);
+  if (!deadlines.empty() && deadlines.begin()->first <= time(nullptr)) {
+    ans = deadlines.begin()->second;
+    deadlines.erase(deadlines.begin());
+    deadline.erase(ans);
+  }
+  pthread_mutex_unlock(&reactor_mutex);
+  return ans;
+}
+static int next_timeout() { // milliseconds for epoll_wait()
+  int ans = -1;
+  pthread_mutex_lock(&reactor_mutex);
+  if (!deadlines.empty()) {
+    time_t dt = deadlines.begin()->first-time(nullptr);
+    ans = (dt <= 0 ? 0 : dt*1000);
+  }
+  pthread_mutex_unlock(&reactor_mutex);
+  return ans;
+}
+static void process(HTTP::Handler* handler) {
+  if (handler->handle()) watch(handler); // wait for more bytes
+  else delete handler;
+}
+
 // client threads
 static sem_t queue_sem;
 static queue<HTTP::Handler*> conn_queue;
@@ -114,10 +185,221 @@ static void* thread(void*) {
     HTTP::Handler* handler = conn_queue.front(); conn_queue.pop();
     pthread_mutex_unlock(&queue_mutex);
     if (!handler) break;
-    handler->handle();
-    delete handler;
+    process(handler);
+  }
+  return nullptr;
+}
+
+// output to (non-blocking) sockets
+static bool writable(ssize_t sysret, int sd) { // true iff should try again
+  static const int timeout = setting(0,"request","timeout");
+  if (sysret >= 0) return false;
+  if (errno == EINTR) return true;
+  if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+  pollfd pfd;
+  pfd.fd = sd;
+  pfd.events = POLLOUT;
+  return poll(&pfd,1,timeout ? timeout*1000 : -1) > 0;
+}
+static bool write_all(int sd, const char* buf, size_t size) {
+  while (size > 0) {
+    ssize_t sysret = write(sd,buf,size);
+    if (sysret > 0) { buf += sysret; size -= sysret; }
+    else if (!writable(sysret,sd)) return false;
+  }
+  return true;
+}
+static bool send_all(int sd, int fd, size_t size) {
+  off_t offset = 0;
+  while (size > 0) {
+    ssize_t sysret = sendfile(sd,fd,&offset,size);
+    if (sysret > 0) size -= sysret;
+    else if (!writable(sysret,sd)) return false; // also if file shrank
+  }
+  return true;
+}
+
+// open files (LRU cache of descriptors and stat results)
+namespace HTTP {
+struct OpenFile {
+  int fd;
+  struct stat st;
+  time_t checked;
+  OpenFile(int fd) : fd(fd), checked(time(nullptr)) { fstat(fd,&st); }
+  ~OpenFile() { ::close(fd); }
+  bool same(const struct stat& o) const {
+    return
+      st.st_dev == o.st_dev && st.st_ino == o.st_ino &&
+      st.st_size == o.st_size &&
+      st.st_mtim.tv_sec == o.st_mtim.tv_sec &&
+      st.st_mtim.tv_nsec == o.st_mtim.tv_nsec
+    ;
+  }
+};
+}
+typedef list<pair<string,shared_ptr<HTTP::OpenFile>>> FileList;
+static FileList files; // most recently used first
+static map<string,FileList::iterator> files_index;
+static pthread_mutex_t files_mutex = PTHREAD_MUTEX_INITIALIZER;
+static shared_ptr<HTTP::OpenFile> open_file(const string& path) {
+  static const size_t max_files = setting(64,"file_cache","max_files");
+  shared_ptr<HTTP::OpenFile> ans;
+  time_t now = time(nullptr);
+  pthread_mutex_lock(&files_mutex);
+  auto it = files_index.find(path);
+  if (it != files_index.end()) {
+    files.splice(files.begin(),files,it->second);
+    ans = files.front().second;
+    struct stat st;
+    if ( // checking the file again at most once per second. a file replaced
+      // by another one (renamed over it, or deleted) has no links left
+      ans->checked == now ||
+      (fstat(ans->fd,&st) == 0 && st.st_nlink > 0 && ans->same(st))
+    ) {
+      ans->checked = now;
+      pthread_mutex_unlock(&files_mutex);
+      return ans;
+    }
+    files.pop_front(); // changed on disk
+    files_index.erase(it);
+    ans.reset();
+  }
+  int fd = open(path.c_str(),O_RDONLY|O_CLOEXEC);
+  if (fd >= 0) {
+    ans.reset(new HTTP::OpenFile(fd));
+    if (!S_ISREG(ans->st.st_mode)) ans.reset();
+  }
+  if (ans && max_files > 0) {
+    files.emplace_front(path,ans);
+    files_index[path] = files.begin();
+    while (files.size() > max_files) {
+      files_index.erase(files.back().first);
+      files.pop_back(); // closed when the last handler using it is done
+    }
+  }
+  pthread_mutex_unlock(&files_mutex);
+  return ans;
+}
+
+// assets (in-memory copies of small static files, kept fresh by inotify)
+namespace HTTP {
+struct Asset {
+  string identity, gzip; // gzip == "" if compressing doesn't pay off
+  string etag;
+};
+}
+static map<string,shared_ptr<const HTTP::Asset>> assets;
+static pthread_mutex_t assets_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int notifyfd = -1;
+static map<int,string> notify_dirs; // watch descriptor -> directory
+static string gzip(const string& src) {
+  z_stream zs;
+  memset(&zs,0,sizeof zs);
+  if (deflateInit2(
+    &zs,Z_BEST_COMPRESSION,Z_DEFLATED,15+16,9,Z_DEFAULT_STRATEGY
+  ) != Z_OK) return "";
+  string ans(deflateBound(&zs,src.size()),'\0');
+  zs.next_in = (Bytef*)src.data();
+  zs.avail_in = src.size();
+  zs.next_out = (Bytef*)&ans[0];
+  zs.avail_out = ans.size();
+  int st = deflate(&zs,Z_FINISH);
+  ans.resize(zs.total_out);
+  deflateEnd(&zs);
+  if (st != Z_STREAM_END || ans.size() >= src.size()) return "";
+  return ans;
+}
+static void load_asset(const string& path) {
+  static const off_t max_size = setting(1048576,"assets","max_file_size");
+  shared_ptr<HTTP::Asset> asset;
+  struct stat st;
+  FILE* fp = nullptr;
+  if (
+    stat(path.c_str(),&st) == 0 && S_ISREG(st.st_mode) &&
+    st.st_size <= max_size && (fp = fopen(path.c_str(),"rb"))
+  ) {
+    asset.reset(new HTTP::Asset);
+    asset->identity.resize(st.st_size);
+    size_t sz = fread(&asset->identity[0],1,st.st_size,fp);
+    asset->identity.resize(sz);
+    fclose(fp);
+    asset->gzip = move(gzip(asset->identity));
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    for (unsigned char c : asset->identity) h = (h^c)*1099511628211ull;
+    asset->etag = "\""+hexstr(h)+"\"";
+  }
+  pthread_mutex_lock(&assets_mutex);
+  if (asset) assets[path] = asset;
+  else assets.erase(path);
+  pthread_mutex_unlock(&assets_mutex);
+}
+static void load_assets(const string& dir) {
+  int wd = inotify_add_watch(
+    notifyfd,dir.c_str(),
+    IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR
+  );
+  if (wd >= 0) notify_dirs[wd] = dir;
+  DIR* dp = opendir(dir.c_str());
+  if (!dp) return;
+  for (dirent* ent = readdir(dp); ent; ent = readdir(dp)) {
+    string fn = ent->d_name;
+    if (fn == "." || fn == "..") continue;
+    fn = dir+"/"+fn;
+    struct stat st;
+    if (stat(fn.c_str(),&st) < 0) continue;
+    if (S_ISDIR(st.st_mode)) load_assets(fn);
+    else load_asset(fn);
+  }
+  closedir(dp);
+}
+static void update_assets() { // reactor thread only
+  char buf[1<<14] __attribute__((aligned(__alignof__(inotify_event))));
+  for (ssize_t len; (len = read(notifyfd,buf,sizeof buf)) > 0;) {
+    for (char* p = buf; p < buf+len;) {
+      auto ev = (inotify_event*)p;
+      p += sizeof(inotify_event)+ev->len;
+      if (ev->mask & IN_IGNORED) { notify_dirs.erase(ev->wd); continue; }
+      auto it = notify_dirs.find(ev->wd);
+      if (it == notify_dirs.end() || !ev->len) continue;
+      string fn = it->second+"/"+ev->name;
+      if (!(ev->mask & IN_ISDIR)) load_asset(fn);
+      else if (ev->mask & (IN_CREATE|IN_MOVED_TO)) load_assets(fn);
+      else { // directory gone
+        pthread_mutex_lock(&assets_mutex);
+        auto jt = assets.lower_bound(fn+"/");
+        fn += "/";
+        while (jt != assets.end() && !jt->first.compare(0,fn.size(),fn)) {
+          assets.erase(jt++);
+        }
+        pthread_mutex_unlock(&assets_mutex);
+      }
+    }
   }
 }
+static shared_ptr<const HTTP::Asset> find_asset(const string& path) {
+  shared_ptr<const HTTP::Asset> ans;
+  pthread_mutex_lock(&assets_mutex);
+  auto it = assets.find(path);
+  if (it != assets.end()) ans = it->second;
+  pthread_mutex_unlock(&assets_mutex);
+  return ans;
+}
+static bool accepts_gzip(const string& accept_encoding) {
+  string tmp = accept_encoding;
+  transform(tmp.begin(),tmp.end(),tmp.begin(),::tolower);
+  tmp.erase(remove_if(tmp.begin(),tmp.end(),::isspace),tmp.end());
+  double gzip = -1, any = -1; // q values, -1 if not listed
+  stringstream ss(tmp);
+  for (string coding; getline(ss,coding,',');) {
+    double q = 1;
+    auto i = coding.find(";q=");
+    if (i != string::npos) q = strtod(coding.c_str()+i+3,nullptr);
+    coding = coding.substr(0,coding.find(';'));
+    if (coding == "gzip" || coding == "x-gzip") gzip = q;
+    else if (coding == "*") any = q;
+  }
+  return (gzip >= 0 ? gzip : any) > 0; // q=0 means "not acceptable"
+}
 
 // sessions
 struct SessionEntry {
@@ -229,9 +511,9 @@ string path(const vector<string>& segments, const string& dir_path) {
   }
   if (ans == "") ans = "index.html";
   if (dir_path != "") ans = dir_path+"/"+ans;
-  struct stat st;
-  stat(ans.c_str(),&st);
-  if (!S_ISREG(st.st_mode)) return "";
+  // a regular file: the caches are checked before asking the file system,
+  // and file() will find it there
+  if (!find_asset(ans) && !open_file(ans)) return "";
   return ans;
 }
 
@@ -275,7 +557,7 @@ Handler::~Handler() {
     for (auto& kv : resp_headers) ss << kv.first << ": " << kv.second << "\r\n";
     ss << "\r\n";
     string resp = move(ss.str());
-    write(sd,resp.c_str(),resp.size());
+    write_all(sd,resp.c_str(),resp.size());
   }
   shutdown(sd,SHUT_WR);
   close(sd);
@@ -386,6 +668,7 @@ void Handler::header(const string& name, const string& value) {
 void Handler::response(const string& d, const string& type) {
   data = d;
   isfile = false;
+  isjson = false;
   if (data == "") {
     resp_headers.erase("Content-Length");
     resp_headers.erase("Content-Type");
@@ -398,15 +681,23 @@ void Handler::response(const string& d, const string& type) {
 }
 
 void Handler::json(const JSON& json) {
-  response(json.generate(),"application/json");
+  Handler::json(move(JSON(json)));
+}
+
+void Handler::json(JSON&& json) {
+  response("");
+  json_ = move(json);
+  isjson = true;
+  resp_headers["Content-Type"] = "application/json";
 }
 
 void Handler::file(const string& path, const string& type) {
   data = path;
   isfile = true;
-  struct stat st;
-  stat(data.c_str(),&st);
-  if (!S_ISREG(st.st_mode)) {
+  isjson = false;
+  asset_ = find_asset(data);
+  if (!asset_) file_ = open_file(data);
+  if (!asset_ && !file_) {
     data = "";
     isfile = false;
     resp_headers.erase("Content-Length");
@@ -414,7 +705,27 @@ void Handler::file(const string& path, const string& type) {
     return;
   }
   stringstream ss;
-  ss << st.st_size;
+  if (!asset_) ss << file_->st.st_size;
+  else { // conditional request and content negotiation
+    gzip_ = (asset_->gzip != "" && accepts_gzip(header("accept-encoding")));
+    string etag = asset_->etag;
+    if (gzip_) etag.insert(etag.size()-1,"-gz");
+    resp_headers["ETag"] = etag;
+    resp_headers["Cache-Control"] = "no-cache";
+    resp_headers["Vary"] = "Accept-Encoding";
+    string inm = header("if-none-match");
+    if (inm == "*" || inm.find(etag) != string::npos) {
+      status(304,"Not Modified");
+      data = "";
+      isfile = false;
+      asset_.reset();
+      resp_headers.erase("Content-Length");
+      resp_headers.erase("Content-Type");
+      return;
+    }
+    if (gzip_) resp_headers["Content-Encoding"] = "gzip";
+    ss << (gzip_ ? asset_->gzip : asset_->identity).size();
+  }
   resp_headers["Content-Length"] = move(ss.str());
   if (type != "") { resp_headers["Content-Type"] = type; return; }
   static const map<string,string> exts{
@@ -462,103 +773,189 @@ void Handler::init(int sd, time_t when, uint32_t ip) {
   this->sd = sd;
   when_ = when;
   ip_ = ip;
-  // socket options
-  static const time_t timeout = setting(0,"request","timeout");
-  timeval tv;
-  memset(&tv,0,sizeof tv);
-  tv.tv_sec = timeout;
-  setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+  fcntl(sd, F_SETFL, fcntl(sd, F_GETFL)|O_NONBLOCK);
+  rpos = 0;
+  nrequests = 0;
+  reset();
+}
+
+void Handler::reset() {
+  // parser
+  pstate = REQUEST_LINE;
+  nheaders = 0;
+  clen = 0;
+  // request
+  method_ = uri_ = version_ = path_ = query_ = "";
+  req_headers.clear();
+  payload_.clear();
   // status line
   st_code = 200;
   st_phrase = "OK";
   st_version = "HTTP/1.1";
   // headers
+  resp_headers.clear();
   resp_headers["Connection"] = "close";
   // response
   data = "";
   isfile = false;
+  json_ = JSON();
+  isjson = false;
+  file_.reset();
+  asset_.reset();
+  // session
+  sess = nullptr;
 }
 
-void Handler::handle() {
-  // request line
-  {
-    static const int max_size = setting(1024,"request","max_uri_size");
-    if (!getline(max_size)) return;
-    if (buf.size() == max_size) { status(414,"Request-URI Too Long"); return; }
-    if (buf == "") { status(400,"Bad Request"); return; }
-    // method
-    auto del = buf.find(' ');
-    if (!del || del == string::npos) { status(400,"Bad Request"); return; }
-    method_ = move(buf.substr(0,del));
-    buf.erase(0,del+1);
-    if (!istoken(method_)) { status(400,"Bad Request"); return; }
-    // URI
-    del = buf.find(' ');
-    if (!del || del == string::npos) { status(400,"Bad Request"); return; }
-    uri_ = move(buf.substr(0,del));
-    buf.erase(0,del+1);
-    if (hasws(uri_)) { status(400,"Bad Request"); return; }
-    // version
-    version_ = move(buf);
-    if (version_.size()!= 8|| !isdigit(version_[5]) || !isdigit(version_[7])) {
-      status(400,"Bad Request");
-      return;
+int Handler::socket() const {
+  return sd;
+}
+
+bool Handler::idle() const {
+  return nrequests > 0 && pstate == REQUEST_LINE && rbuf.empty();
+}
+
+void Handler::expire() {
+  if (idle()) st_code = 0; // just close a kept-alive connection
+  else status(408,"Request Timeout");
+}
+
+bool Handler::handle() {
+  for (int sysret = 1; sysret > 0;) {
+    sysret = receive();
+    while (parse(sysret == 0)) { // there may be pipelined requests
+      if (!respond()) return false;
+      reset();
     }
-    char mj = version_[5], mn = version_[7];
-    version_[5] = '0'; version_[7] = '0';
-    if (version_ != "HTTP/0.0") { status(400,"Bad Request"); return; }
-    version_[5] = mj; version_[7] = mn;
+    if (st_code != 200 || sysret == 0) return false; // bad request or eof
   }
-  
-  // request headers
-  for (int headers = 0; ; headers++) {
-    static const int max_size = setting(1024,"request","max_header_size");
-    static const int max_headers = setting(1024,"request","max_headers");
-    // stop conditions
-    if (!getline(max_size)) return;
-    if (buf == "") break; // done
-    if (buf.size() == max_size || headers == max_headers) {
-      status(431,"Request Header Fields Too Large");
-      return;
+  return true; // wait for more bytes
+}
+
+int Handler::receive() {
+  char tmp[1<<16];
+  ssize_t sysret;
+  do sysret = read(sd,tmp,sizeof tmp); while (sysret < 0 && errno == EINTR);
+  if (sysret > 0) rbuf.append(tmp,sysret);
+  if (sysret >= 0) return sysret;
+  return (errno == EAGAIN || errno == EWOULDBLOCK) ? -1 : 0;
+}
+
+bool Handler::parse(bool eof) {
+  static const int max_uri = setting(1024,"request","max_uri_size");
+  static const int max_header = setting(1024,"request","max_header_size");
+  static const int max_headers = setting(1024,"request","max_headers");
+  while (pstate != READY) {
+    // message body (handling only content-length header)
+    if (pstate == PAYLOAD) {
+      size_t len = min(clen-payload_.size(),rbuf.size()-rpos);
+      payload_.insert(payload_.end(),rbuf.begin()+rpos,rbuf.begin()+rpos+len);
+      rpos += len;
+      if (payload_.size() == clen) { pstate = READY; continue; }
+      if (eof) status(400,"Bad Request");
+      break;
     }
-    // name
-    auto colon = buf.find(':');
-    if (!colon || colon == string::npos) { status(400,"Bad Request"); return; }
-    string name = move(buf.substr(0,colon));
-    buf.erase(0,colon+1);
-    if (!istoken(name)) { status(400,"Bad Request"); return; }
-    transform(name.begin(),name.end(),name.begin(),::tolower);
-    // value
-    int l = 0, r = buf.size()-1;
-    while (buf[l] == ' ' || buf[l] == '\t') l++;
-    while (0 <= r && (buf[r] == ' ' || buf[r] == '\t')) r--;
-    string value;
-    if (r < l) value = "1";
-    else value = move(buf.substr(l,r-l+1));
-    req_headers[move(name)] = move(value);
-  }
-  
-  // message body (handling only content-length header)
-  {
-    static const int max_size = setting(1048576,"request","max_payload_size");
-    int clen;
-    auto it = req_headers.find("content-length");
-    if (it != req_headers.end() && sscanf(it->second.c_str(),"%d",&clen) == 1) {
-      if (sscanf(it->second.c_str(),"%d",&clen) != 1) {
-        status(411,"Length Required");
-        return;
-      }
-      if (clen > max_size) { status(413,"Request Entity Too Large"); return; }
-      uint8_t buf;
-      int sysret;
-      for (int i = 0; i < clen; i++) {
-        if ((sysret = read(sd,&buf,1)) == 1) payload_.push_back(buf);
-        else if (sysret == 0) { status(400,"Bad Request"); return; }
-        else { status(408,"Request Timeout"); return; }
+    // request line and header fields
+    size_t max_size = (pstate == REQUEST_LINE ? max_uri : max_header);
+    auto eol = rbuf.find("\r\n",rpos);
+    if (eol == string::npos) eol = rbuf.size();
+    if (eol-rpos+2 > max_size) {
+      if (pstate == REQUEST_LINE) status(414,"Request-URI Too Long");
+      else status(431,"Request Header Fields Too Large");
+      return false;
+    }
+    if (eol == rbuf.size()) {
+      if (eof && idle()) st_code = 0; // client closed a kept-alive connection
+      else if (eof) status(400,"Bad Request");
+      break;
+    }
+    buf = rbuf.substr(rpos,eol-rpos);
+    rpos = eol+2;
+    if (buf.find('\0') != string::npos) { status(400,"Bad Request"); break; }
+    if (pstate == REQUEST_LINE) {
+      when_ = time(nullptr);
+      if (!request_line()) break;
+      pstate = HEADERS;
+    }
+    else if (buf != "") {
+      if (nheaders++ == max_headers) {
+        status(431,"Request Header Fields Too Large");
+        break;
       }
+      if (!header_line()) break;
     }
+    else if (!content_length()) break;
+    else pstate = (clen > 0 ? PAYLOAD : READY);
   }
-  
+  // drop consumed bytes, keeping what's left (pipelined requests)
+  rbuf.erase(0,rpos);
+  rpos = 0;
+  return pstate == READY;
+}
+
+bool Handler::request_line() {
+  if (buf == "") { status(400,"Bad Request"); return false; }
+  // method
+  auto del = buf.find(' ');
+  if (!del || del == string::npos) { status(400,"Bad Request"); return false; }
+  method_ = move(buf.substr(0,del));
+  buf.erase(0,del+1);
+  if (!istoken(method_)) { status(400,"Bad Request"); return false; }
+  // URI
+  del = buf.find(' ');
+  if (!del || del == string::npos) { status(400,"Bad Request"); return false; }
+  uri_ = move(buf.substr(0,del));
+  buf.erase(0,del+1);
+  if (hasws(uri_)) { status(400,"Bad Request"); return false; }
+  // version
+  version_ = move(buf);
+  if (version_.size()!= 8|| !isdigit(version_[5]) || !isdigit(version_[7])) {
+    status(400,"Bad Request");
+    return false;
+  }
+  char mj = version_[5], mn = version_[7];
+  version_[5] = '0'; version_[7] = '0';
+  if (version_ != "HTTP/0.0") { status(400,"Bad Request"); return false; }
+  version_[5] = mj; version_[7] = mn;
+  return true;
+}
+
+bool Handler::header_line() {
+  // name
+  auto colon = buf.find(':');
+  if (!colon || colon == string::npos) {
+    status(400,"Bad Request");
+    return false;
+  }
+  string name = move(buf.substr(0,colon));
+  buf.erase(0,colon+1);
+  if (!istoken(name)) { status(400,"Bad Request"); return false; }
+  transform(name.begin(),name.end(),name.begin(),::tolower);
+  // value
+  int l = 0, r = buf.size()-1;
+  while (buf[l] == ' ' || buf[l] == '\t') l++;
+  while (0 <= r && (buf[r] == ' ' || buf[r] == '\t')) r--;
+  string value;
+  if (r < l) value = "1";
+  else value = move(buf.substr(l,r-l+1));
+  req_headers[move(name)] = move(value);
+  return true;
+}
+
+bool Handler::content_length() {
+  static const int max_size = setting(1048576,"request","max_payload_size");
+  int len;
+  clen = 0;
+  auto it = req_headers.find("content-length");
+  if (it == req_headers.end() || sscanf(it->second.c_str(),"%d",&len) != 1) {
+    return true;
+  }
+  if (len > max_size) { status(413,"Request Entity Too Large"); return false; }
+  if (len > 0) clen = len;
+  payload_.reserve(clen);
+  return true;
+}
+
+bool Handler::respond() {
   // load session
   string sid;
   sess = nullptr;
@@ -581,7 +978,7 @@ void Handler::handle() {
       if (!sess) {
         resp_headers["Set-Cookie"] = delcook();
         location("/");
-        return;
+        return false;
       }
     }
   }
@@ -638,42 +1035,82 @@ void Handler::handle() {
   if (new_sess) resp_headers["Set-Cookie"] = setcook();
   else if (sid != "" && !sess) resp_headers["Set-Cookie"] = delcook();
   
+  // persistent connection
+  static const int max_requests = setting(100,"keep_alive","max_requests");
+  static const int idle_timeout = setting(5,"keep_alive","timeout");
+  string conn = header("connection");
+  transform(conn.begin(),conn.end(),conn.begin(),::tolower);
+  bool keep = (
+    ++nrequests < max_requests && (
+      version_ == "HTTP/1.1" ? conn != "close" : conn == "keep-alive"
+    )
+  );
+  if (keep) {
+    resp_headers["Connection"] = "keep-alive";
+    resp_headers["Keep-Alive"] = "timeout="+to_string(idle_timeout);
+  }
+  if (isjson && (method_ == "HEAD" || version_ != "HTTP/1.1")) { // no chunks
+    response(json_.generate(),"application/json");
+  }
+  if (!isfile && !isjson && data == "" && st_code != 304) {
+    resp_headers["Content-Length"] = "0";
+  }
+  
   // response
+  if (isjson) return send_json() && keep;
+  if (!send_head()) return false;
+  if (method_ == "HEAD") return keep;
+  if (!isfile) {
+    if (data != "" && !write_all(sd,data.c_str(),data.size())) return false;
+    return keep;
+  }
+  if (asset_) {
+    const string& body = (gzip_ ? asset_->gzip : asset_->identity);
+    return write_all(sd,body.c_str(),body.size()) && keep;
+  }
+  return send_all(sd,file_->fd,file_->st.st_size) && keep;
+}
+
+bool Handler::send_head() {
   stringstream ss;
   ss << st_version << " " << st_code << " " << st_phrase << "\r\n";
   st_code = 0; // destructor will send another status line if st_code != 0
   for (auto& kv : resp_headers) ss << kv.first << ": " << kv.second << "\r\n";
   ss << "\r\n";
   string resp = move(ss.str());
-  write(sd,resp.c_str(),resp.size());
-  if (method_ == "HEAD") return;
-  if (!isfile) {
-    if (data != "") write(sd,data.c_str(),data.size());
-    return;
-  }
-  FILE* fp = fopen(data.c_str(),"rb");
-  uint8_t* buf = new uint8_t[1<<20];
-  for (int sz; (sz = fread(buf,1,1<<20,fp)) > 0; write(sd,buf,sz));
-  delete[] buf;
-  fclose(fp);
-}
-
-bool Handler::getline(int max_size) {
-  buf = "";
-  int i = 0, sysret;
-  for (char c; (sysret = read(sd,&c,1)) == 1 && buf.size() < max_size;) {
-    if (c == 0) { status(400,"Bad Request"); return false; }
-    buf += c;
-    i++;
-    if (i > 1 && buf[i-2] == '\r' && buf[i-1] == '\n') {
-      buf.erase(i-2,string::npos);
-      return true;
+  return write_all(sd,resp.c_str(),resp.size());
+}
+
+// a JSON that fits in one 64 kB chunk is sent with its length, like any other
+// response. larger ones go out chunked while they are generated
+bool Handler::send_json() {
+  bool chunked = false;
+  auto chunk = [&](const string& buf) {
+    char size[24];
+    snprintf(size,sizeof size,"%zx\r\n",buf.size());
+    return
+      write_all(sd,size,strlen(size)) &&
+      write_all(sd,buf.c_str(),buf.size()) &&
+      write_all(sd,"\r\n",2)
+    ;
+  };
+  string buf;
+  bool ok = json_.generate(buf,[&](string& buf) {
+    if (!chunked) {
+      chunked = true;
+      resp_headers["Transfer-Encoding"] = "chunked";
+      if (!send_head()) return false;
     }
+    bool ans = chunk(buf);
+    buf.clear();
+    return ans;
+  });
+  if (!ok) return false;
+  if (!chunked) {
+    resp_headers["Content-Length"] = to_string(buf.size());
+    return send_head() && write_all(sd,buf.c_str(),buf.size());
   }
-  if (buf.size() == max_size) return true;
-  if (sysret < 0) status(408,"Request Timeout");
-  else status(400,"Bad Request");
-  return false;
+  return (buf.empty() || chunk(buf)) && write_all(sd,"0\r\n\r\n",5);
 }
 
 void server(
@@ -709,27 +1146,66 @@ void server(
     threads.emplace_back();
     pthread_create(&threads.back(), nullptr, thread, nullptr);
   }
+  auto dispatch = [&](Handler* handler) {
+    if (threads.size() == 0) { process(handler); return; }
+    pthread_mutex_lock(&queue_mutex);
+    conn_queue.push(handler);
+    pthread_mutex_unlock(&queue_mutex);
+    sem_post(&queue_sem);
+  };
+  
+  // create reactor
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  wakefd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  epoll_event ev;
+  memset(&ev, 0, sizeof ev);
+  ev.events = EPOLLIN;
+  ev.data.ptr = &listen_tag;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, ssd, &ev);
+  ev.data.ptr = &wake_tag;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+  
+  // load assets
+  JSON apath = setts("assets","path");
+  if (apath.isstr() && !apath.isnull() && apath.str() != "") {
+    notifyfd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    ev.data.ptr = &notify_tag;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, notifyfd, &ev);
+    load_assets(apath.str());
+  }
   
   // listen
   listen(ssd, SOMAXCONN);
+  epoll_event evs[64];
   while (alive()) {
     clean_sessions();
-    sockaddr_in addr;
-    socklen_t addrlen = sizeof addr;
-    int sd = accept(ssd, (sockaddr*)&addr, &addrlen);
-    time_t when = time(nullptr);
-    if (sd < 0) { usleep(25000); continue; }
-    Handler* tmp = handler_factory();
-    tmp->init(sd,when,addr.sin_addr.s_addr);
-    if (threads.size() == 0) {
-      tmp->handle();
-      delete tmp;
+    int n = epoll_wait(epfd, evs, 64, next_timeout());
+    for (int i = 0; i < n; i++) {
+      void* ptr = evs[i].data.ptr;
+      if (ptr == &wake_tag) {
+        uint64_t cnt;
+        read(wakefd, &cnt, sizeof cnt);
+      }
+      else if (ptr == &notify_tag) update_assets();
+      else if (ptr == &listen_tag) for (;;) { // accept the whole backlog
+        sockaddr_in addr;
+        socklen_t addrlen = sizeof addr;
+        int sd = accept(ssd, (sockaddr*)&addr, &addrlen);
+        if (sd < 0) break;
+        Handler* tmp = handler_factory();
+        tmp->init(sd,time(nullptr),addr.sin_addr.s_addr);
+        watch(tmp,false);
+      }
+      else { // request bytes arrived
+        Handler* handler = (Handler*)ptr;
+        unwatch(handler);
+        dispatch(handler);
+      }
     }
-    else {
-      pthread_mutex_lock(&queue_mutex);
-      conn_queue.push(tmp);
-      pthread_mutex_unlock(&queue_mutex);
-      sem_post(&queue_sem);
+    // expire connections whose request didn't arrive in time
+    for (Handler* handler; (handler = expired());) {
+      handler->expire();
+      delete handler;
     }
   }
   
@@ -742,8 +1218,24 @@ void server(
   }
   for (pthread_t& th : threads) pthread_join(th, nullptr);
   
+  // drop idle connections
+  while (!deadline.empty()) {
+    Handler* handler = deadline.begin()->first;
+    unwatch(handler);
+    handler->expire();
+    delete handler;
+  }
+  
   // close
+  if (notifyfd >= 0) close(notifyfd);
+  close(wakefd);
+  close(epfd);
   close(ssd);
 }
 
+void interrupt() {
+  uint64_t one = 1;
+  if (wakefd >= 0) write(wakefd, &one, sizeof one);
+}
+
 } // namespace HTTP
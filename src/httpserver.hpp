@@ -2,6 +2,7 @@
 #define HTTPSERVER_H
 
 #include <functional>
+#include <memory>
 
 #include "json.hpp"
 
@@ -14,6 +15,9 @@ std::string path( // valid iff != ""
   const std::string& dir_path = ""
 );
 
+struct OpenFile; // hidden class for implementation
+struct Asset; // hidden class for implementation
+
 class Session {
   public:
     virtual ~Session();
@@ -72,7 +76,8 @@ class Handler {
     );
     void header(const std::string& name, const std::string& value);
     void response(const std::string& data,const std::string& type = "");
-    void json(const JSON&);
+    void json(const JSON&); // sent chunked if it's large
+    void json(JSON&&);
     void file(const std::string& path, const std::string& type = "");
     void attachment(const std::string& path);
     // session
@@ -93,6 +98,10 @@ class Handler {
     time_t when_;
     uint32_t ip_;
     // request
+    enum {REQUEST_LINE = 0, HEADERS, PAYLOAD, READY};
+    std::string rbuf; // received bytes not yet parsed
+    size_t rpos, clen;
+    int pstate, nheaders, nrequests;
     std::string buf, method_, uri_, version_, path_, query_;
     std::map<std::string,std::string> req_headers;
     std::vector<uint8_t> payload_;
@@ -101,13 +110,27 @@ class Handler {
     std::string st_phrase, st_version;
     std::map<std::string,std::string> resp_headers;
     std::string data; bool isfile;
+    JSON json_; bool isjson;
+    std::shared_ptr<OpenFile> file_;
+    std::shared_ptr<const Asset> asset_; bool gzip_;
     // session
     Session* sess;
   public:
     void init(int,time_t,uint32_t);
-    void handle();
+    int socket() const;
+    bool idle() const; // kept alive, waiting for the next request
+    bool handle(); // true iff the connection is waiting for more bytes
+    void expire(); // request timed out
   private:
-    bool getline(int);
+    int receive(); // bytes read, 0 on eof or -1 if it would block
+    bool parse(bool eof); // true iff the request is complete
+    bool request_line();
+    bool header_line();
+    bool content_length();
+    bool respond(); // true iff the connection must be kept alive
+    bool send_head();
+    bool send_json();
+    void reset(); // prepares for the next request
 };
 
 void server(
@@ -115,6 +138,7 @@ void server(
   std::function<bool()> alive,
   std::function<Handler*()> handler_factory = []() { return new Handler; }
 );
+void interrupt(); // wakes server() up so alive() is checked again
 
 } // namespace HTTP
 
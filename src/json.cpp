@@ -1,307 +1,30 @@
 #include <cstring>
-#include <stack>
+#include <cerrno>
+#include <cmath>
 #include <fstream>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "json.hpp"
 
 using namespace std;
 
-static string to_json(const string& val, bool force = false);
+static void to_json(const string& val, string& out, bool force = false);
 static size_t json_number_length(const char* val);
 static bool is_json_zero(const string& val);
-static bool operator>>(istream& is, JSON& json);
 static void encode_utf8(unsigned cpt, string& buf);
 static bool isctl(unsigned char c);
 static const uint8_t* decode_utf8(const uint8_t* s, string& buf);
+static bool parse_json(const char* src, size_t n, JSON& json);
 
-struct JSONValue {
-  virtual ~JSONValue() {}
-  virtual JSONValue* clone() const = 0;
-  virtual bool isstr() const = 0;
-  virtual string& str() = 0;
-  virtual bool isobj() const = 0;
-  virtual bool issubobj(const JSON&) const = 0;
-  virtual map<string,JSON>& obj() = 0;
-  virtual JSON& operator[](const string&) = 0;
-  virtual JSON& operator[](string&&) = 0;
-  virtual map<string,JSON>::iterator find(const string&) = 0;
-  virtual map<string,JSON>::const_iterator find(const string&) const = 0;
-  virtual map<string,JSON>::iterator erase(
-    map<string,JSON>::const_iterator
-  ) = 0;
-  virtual size_t erase(const string&) = 0;
-  virtual bool isarr() const = 0;
-  virtual vector<JSON>& arr() = 0;
-  virtual void push_back(const JSON&) = 0;
-  virtual void push_back(JSON&&) = 0;
-  virtual JSON& operator[](size_t i) = 0;
-  virtual vector<JSON>::iterator erase(vector<JSON>::iterator) = 0;
-  virtual vector<JSON>::iterator erase(
-    vector<JSON>::iterator,
-    vector<JSON>::iterator
-  ) = 0;
-  virtual size_t size() const = 0;
-  virtual bool equals(const JSON&) const = 0;
-  virtual string generate(unsigned) const = 0;
-};
-
-struct String : public JSONValue {
-  string v;
-  String(const string& v) : v(v) {}
-  String(string&& v) : v(move(v)) {}
-  JSONValue* clone() const {
-    return new String(v);
-  }
-  bool isstr() const {
-    return true;
-  }
-  string& str() {
-    return v;
-  }
-  bool isobj() const {
-    return false;
-  }
-  bool issubobj(const JSON&) const {
-    return false;
-  }
-  map<string,JSON>& obj() {
-    
-  }
-  JSON& operator[](const string&) {
-    
-  }
-  JSON& operator[](string&&) {
-    
-  }
-  map<string,JSON>::iterator find(const string&) {
-    
-  }
-  map<string,JSON>::const_iterator find(const string&) const {
-    
-  }
-  map<string,JSON>::iterator erase(map<string,JSON>::const_iterator) {
-    
-  }
-  size_t erase(const string&) {
-    
-  }
-  bool isarr() const {
-    return false;
-  }
-  vector<JSON>& arr() {
-    
-  }
-  void push_back(const JSON&) {
-    
-  }
-  void push_back(JSON&&) {
-    
-  }
-  JSON& operator[](size_t) {
-    
-  }
-  vector<JSON>::iterator erase(vector<JSON>::iterator) {
-    
-  }
-  vector<JSON>::iterator erase(vector<JSON>::iterator,vector<JSON>::iterator) {
-    
-  }
-  size_t size() const {
-    return v.size();
-  }
-  bool equals(const JSON& o) const {
-    return o.isstr() && v == o.str();
-  }
-  string generate(unsigned) const {
-    return to_json(v);
-  }
-};
-
-struct Object : public JSONValue {
-  map<string,JSON> v;
-  Object() {}
-  Object(const map<string,JSON>& v) : v(v) {}
-  JSONValue* clone() const {
-    return new Object(v);
-  }
-  bool isstr() const {
-    return false;
-  }
-  string& str() {
-    
-  }
-  bool isobj() const {
-    return true;
-  }
-  bool issubobj(const JSON& sup) const {
-    if (!sup.isobj()) return false;
-    auto& vsup = sup.obj();
-    for (auto& kv : v) {
-      auto it = vsup.find(kv.first);
-      if (it == vsup.end()) return false;
-      auto& a = kv.second;
-      auto& b = it->second;
-      if (a.isobj() && b.isobj() && a.issubobj(b)) continue;
-      if (!a.equals(b)) return false;
-    }
-    return true;
-  }
-  map<string,JSON>& obj() {
-    return v;
-  }
-  JSON& operator[](const string& key) {
-    return v[key];
-  }
-  JSON& operator[](string&& key) {
-    return v[move(key)];
-  }
-  map<string,JSON>::iterator find(const string& key) {
-    return v.find(key);
-  }
-  map<string,JSON>::const_iterator find(const string& key) const {
-    return v.find(key);
-  }
-  map<string,JSON>::iterator erase(map<string,JSON>::const_iterator it) {
-    return v.erase(it);
-  }
-  size_t erase(const string& key) {
-    return v.erase(key);
-  }
-  bool isarr() const {
-    return false;
-  }
-  vector<JSON>& arr() {
-    
-  }
-  void push_back(const JSON&) {
-    
-  }
-  void push_back(JSON&&) {
-    
-  }
-  JSON& operator[](size_t) {
-    
-  }
-  vector<JSON>::iterator erase(vector<JSON>::iterator) {
-    
-  }
-  vector<JSON>::iterator erase(vector<JSON>::iterator,vector<JSON>::iterator) {
-    
-  }
-  size_t size() const {
-    return v.size();
-  }
-  bool equals(const JSON& o) const {
-    if (!o.isobj() || v.size() != o.size()) return false;
-    for (auto i = v.begin(), j = o.obj().begin(); i != v.end(); i++, j++) {
-      if (i->first != j->first || !i->second.equals(j->second)) return false;
-    }
-    return true;
-  }
-  string generate(unsigned indent) const {
-    string ans = "{"; if (indent) ans += "\n";
-    auto cnt = v.size();
-    for (auto it = v.begin(); it != v.end(); it++) {
-      for (int i = 0; i < indent; i++) ans += "  ";
-      ans += to_json(it->first,true);
-      ans += ": ";
-      ans += it->second.generate(indent ? indent+1 : 0);
-      cnt--;
-      if (cnt > 0) ans += ",";
-      if (indent) ans += "\n";
-    }
-    if (indent) for (int i = 0; i < indent-1; i++) ans += "  ";
-    ans += "}";
-    return ans;
-  }
-};
-
-struct Array : public JSONValue {
-  vector<JSON> v;
-  Array(const vector<JSON>& v) : v(v) {}
-  Array(vector<JSON>&& v) : v(move(v)) {}
-  JSONValue* clone() const {
-    return new Array(v);
-  }
-  bool isstr() const {
-    return false;
-  }
-  string& str() {
-    
-  }
-  bool isobj() const {
-    return false;
-  }
-  bool issubobj(const JSON&) const {
-    return false;
-  }
-  map<string,JSON>& obj() {
-    
-  }
-  JSON& operator[](const string&) {
-    
-  }
-  JSON& operator[](string&&) {
-    
-  }
-  map<string,JSON>::iterator find(const string&) {
-    
-  }
-  map<string,JSON>::const_iterator find(const string&) const {
-    
-  }
-  map<string,JSON>::iterator erase(map<string,JSON>::const_iterator) {
-    
-  }
-  size_t erase(const string&) {
-    
-  }
-  bool isarr() const {
-    return true;
-  }
-  vector<JSON>& arr() {
-    return v;
-  }
-  void push_back(const JSON& val) {
-    v.push_back(val);
-  }
-  void push_back(JSON&& val) {
-    v.emplace_back();
-    v.back() = move(val);
-  }
-  JSON& operator[](size_t i) {
-    return v[i];
-  }
-  vector<JSON>::iterator erase(vector<JSON>::iterator position) {
-    return v.erase(position);
-  }
-  vector<JSON>::iterator erase(
-    vector<JSON>::iterator first,
-    vector<JSON>::iterator last
-  ) {
-    return v.erase(first,last);
-  }
-  size_t size() const {
-    return v.size();
-  }
-  bool equals(const JSON& o) const {
-    if (!o.isarr() || v.size() != o.size()) return false;
-    for (int i = 0; i < v.size(); i++) if (!v[i].equals(o[i])) return false;
-    return true;
-  }
-  string generate(unsigned indent) const {
-    string ans = "["; if (indent) ans += "\n";
-    for (int i = 0; i < v.size(); i++) {
-      for (int i = 0; i < indent; i++) ans += "  ";
-      ans += v[i].generate(indent ? indent+1 : 0);
-      if (i < v.size()-1) ans += ",";
-      if (indent) ans += "\n";
-    }
-    if (indent) for (int i = 0; i < indent-1; i++) ans += "  ";
-    ans += "]";
-    return ans;
-  }
-};
+// a JSON is a tagged union. numbers and literals are strings that know what
+// they are: their text is kept as given, so the output doesn't change
+enum {STR,NUM,LIT,OBJ,ARR};
 
 JSON::number::number(const char* s) :
 is_num(false), is_neg(false), is_exp_neg(false)
@@ -352,34 +75,45 @@ string JSON::number::exp() const {
   return exp_;
 }
 
-JSON::JSON() : value(new Object) {
-  
+JSON::JSON() : kind(OBJ), isint(false) {
+  new (&object) map<string,JSON>;
 }
 
 JSON::~JSON() {
-  delete value;
+  destroy();
 }
 
-JSON::JSON(const JSON& val) : value(nullptr) {
-  operator=(val);
+JSON::JSON(const JSON& val) : kind(val.kind), isint(val.isint) {
+  switch (kind) {
+    case OBJ: new (&object) map<string,JSON>(val.object); break;
+    case ARR: new (&array) vector<JSON>(val.array);       break;
+    default:  new (&scalar) Scalar(val.scalar);           break;
+  }
 }
 
 JSON& JSON::operator=(const JSON& val) {
-  delete value;
-  value = (val.value ? val.value->clone() : nullptr);
+  if (this != &val) operator=(move(JSON(val))); // val may belong to this
   return *this;
 }
 
-JSON::JSON(JSON&& val) : value(nullptr) {
-  operator=(move(val));
+JSON::JSON(JSON&& val) : kind(val.kind), isint(val.isint) {
+  switch (kind) {
+    case OBJ: new (&object) map<string,JSON>(move(val.object)); break;
+    case ARR: new (&array) vector<JSON>(move(val.array));       break;
+    default:  new (&scalar) Scalar(move(val.scalar));           break;
+  }
 }
 
 JSON& JSON::operator=(JSON&& val) {
-  swap(value,val.value);
+  if (this == &val) return *this;
+  JSON tmp(move(val)); // val may belong to this
+  destroy();
+  new (this) JSON(move(tmp));
   return *this;
 }
 
-JSON::JSON(const char* val) : value(nullptr) {
+JSON::JSON(const char* val) : kind(OBJ), isint(false) {
+  new (&object) map<string,JSON>;
   operator=(move(string(val)));
 }
 
@@ -387,92 +121,114 @@ JSON& JSON::operator=(const char* val) {
   return operator=(move(string(val)));
 }
 
-JSON::JSON(const string& val) : value(nullptr) {
-  operator=(val);
+JSON::JSON(const string& val) : kind(OBJ), isint(false) {
+  new (&object) map<string,JSON>;
+  operator=(move(string(val)));
 }
 
 JSON& JSON::operator=(const string& val) {
-  delete value;
-  value = new String(val);
-  return *this;
+  return operator=(move(string(val)));
 }
 
-JSON::JSON(string&& val) : value(nullptr) {
+JSON::JSON(string&& val) : kind(OBJ), isint(false) {
+  new (&object) map<string,JSON>;
   operator=(move(val));
 }
 
 JSON& JSON::operator=(string&& val) {
-  delete value;
-  value = new String(move(val));
+  string text = move(val); // val may belong to this
+  destroy();
+  new (&scalar) Scalar;
+  scalar.text = move(text);
+  const string& v = scalar.text;
+  kind = STR;
+  isint = false;
+  if (v.size() > 0 && json_number_length(v.c_str()) == v.size()) {
+    kind = NUM;
+    scalar.d = strtod(v.c_str(),nullptr);
+    if (v.find_first_of(".eE") == string::npos) {
+      errno = 0;
+      scalar.i = strtoll(v.c_str(),nullptr,10);
+      isint = (errno == 0);
+    }
+  }
+  else if (v == "true" || v == "false" || v == "null") kind = LIT;
   return *this;
 }
 
-JSON::JSON(const map<string,JSON>& val) : value(nullptr) {
-  operator=(val);
+JSON& JSON::operator=(double val) {
+  stringstream ss;
+  ss << val;
+  return operator=(move(ss.str()));
+}
+
+JSON::JSON(const map<string,JSON>& val) : kind(OBJ), isint(false) {
+  new (&object) map<string,JSON>(val);
 }
 
 JSON& JSON::operator=(const map<string,JSON>& val) {
-  delete value;
-  value = new Object(val);
-  return *this;
+  return operator=(move(map<string,JSON>(val)));
 }
 
-JSON::JSON(map<string,JSON>&& val) : value(nullptr) {
-  operator=(move(val));
+JSON::JSON(map<string,JSON>&& val) : kind(OBJ), isint(false) {
+  new (&object) map<string,JSON>(move(val));
 }
 
 JSON& JSON::operator=(map<string,JSON>&& val) {
-  delete value;
-  value = new Object(move(val));
+  map<string,JSON> tmp(move(val)); // val may belong to this
+  destroy();
+  kind = OBJ;
+  new (&object) map<string,JSON>(move(tmp));
   return *this;
 }
 
-JSON::JSON(const vector<JSON>& val) : value(nullptr) {
-  operator=(val);
+JSON::JSON(const vector<JSON>& val) : kind(ARR), isint(false) {
+  new (&array) vector<JSON>(val);
 }
 
 JSON& JSON::operator=(const vector<JSON>& val) {
-  delete value;
-  value = new Array(val);
-  return *this;
+  return operator=(move(vector<JSON>(val)));
 }
 
-JSON::JSON(vector<JSON>&& val) : value(nullptr) {
-  operator=(move(val));
+JSON::JSON(vector<JSON>&& val) : kind(ARR), isint(false) {
+  new (&array) vector<JSON>(move(val));
 }
 
 JSON& JSON::operator=(vector<JSON>&& val) {
-  delete value;
-  value = new Array(move(val));
+  vector<JSON> tmp(move(val)); // val may belong to this
+  destroy();
+  kind = ARR;
+  new (&array) vector<JSON>(move(tmp));
   return *this;
 }
 
 bool JSON::isstr() const {
-  return value->isstr();
+  return kind != OBJ && kind != ARR;
 }
 
-string& JSON::str() {
-  return value->str();
+string& JSON::str() { // the caller may change the text, so forget its type
+  if (kind == NUM || kind == LIT) kind = STR, isint = false;
+  return scalar.text;
 }
 
 const string& JSON::str() const {
-  return value->str();
+  return scalar.text;
 }
 
 JSON::operator string&() {
-  return value->str();
+  return str();
 }
 
 JSON::operator const string&() const {
-  return value->str();
+  return scalar.text;
 }
 
 bool JSON::operator==(const string& val) const {
-  return value->isstr() && val == value->str();
+  return isstr() && val == scalar.text;
 }
 
 bool JSON::operator!=(const string& val) const {
-  return value->isstr() && val != value->str();
+  return isstr() && val != scalar.text;
 }
 
 bool operator==(const string& val, const JSON& json) {
@@ -484,110 +240,151 @@ bool operator!=(const string& val, const JSON& json) {
 }
 
 bool JSON::isnum() const {
-  return
-    value->isstr() &&
-    value->size() > 0 &&
-    json_number_length(((const string&)*this).c_str()) == value->size()
-  ;
+  if (kind == NUM) return true;
+  if (kind != STR) return false;
+  auto& v = scalar.text; // may have been changed through str()
+  return v.size() > 0 && json_number_length(v.c_str()) == v.size();
 }
 
 JSON::number JSON::num() const {
-  return number(value->isstr() ? ((const string&)*this).c_str() : "");
+  return number(isstr() ? scalar.text.c_str() : "");
+}
+
+void JSON::destroy() {
+  switch (kind) {
+    case OBJ: object.~map<string,JSON>(); break;
+    case ARR: array.~vector<JSON>();      break;
+    default:  scalar.~Scalar();           break;
+  }
+}
+
+void JSON::set(long long val, bool is_signed) {
+  destroy();
+  new (&scalar) Scalar;
+  char buf[24];
+  snprintf(buf,sizeof buf,is_signed ? "%lld" : "%llu",val);
+  scalar.text = buf;
+  scalar.i = val;
+  scalar.d = (is_signed ? double(val) : double((unsigned long long)val));
+  kind = NUM;
+  isint = (is_signed || val >= 0);
+}
+
+bool JSON::integer(long long& buf) const {
+  if (kind != NUM || !isint) return false;
+  buf = scalar.i;
+  return true;
+}
+
+bool JSON::real(double& buf) const { // out of range is left to stringstream
+  if (kind != NUM || isinf(scalar.d)) return false;
+  buf = scalar.d;
+  return true;
 }
 
 bool JSON::isobj() const {
-  return value->isobj();
+  return kind == OBJ;
 }
 
 bool JSON::issubobj(const JSON& sup) const {
-  return value->issubobj(sup);
+  if (kind != OBJ || !sup.isobj()) return false;
+  auto& vsup = sup.obj();
+  for (auto& kv : object) {
+    auto it = vsup.find(kv.first);
+    if (it == vsup.end()) return false;
+    auto& a = kv.second;
+    auto& b = it->second;
+    if (a.isobj() && b.isobj() && a.issubobj(b)) continue;
+    if (!a.equals(b)) return false;
+  }
+  return true;
 }
 
 map<string,JSON>& JSON::obj() {
-  return value->obj();
+  return object;
 }
 
 const map<string,JSON>& JSON::obj() const {
-  return value->obj();
+  return object;
 }
 
 JSON& JSON::operator[](const char* key) {
-  return (*value)[string(key)];
+  return object[string(key)];
 }
 
 JSON& JSON::operator[](const string& key) {
-  return (*value)[key];
+  return object[key];
 }
 
 JSON& JSON::operator[](string&& key) {
-  return (*value)[move(key)];
+  return object[move(key)];
 }
 
 map<string,JSON>::iterator JSON::find(const string& key) {
-  return value->find(key);
+  return object.find(key);
 }
 
 map<string,JSON>::const_iterator JSON::find(const string& key) const {
-  return value->find(key);
+  return object.find(key);
 }
 
 map<string,JSON>::iterator JSON::erase(map<string,JSON>::const_iterator it) {
-  return value->erase(it);
+  return object.erase(it);
 }
 
 size_t JSON::erase(const string& key) {
-  return value->erase(key);
+  return object.erase(key);
 }
 
 bool JSON::isarr() const {
-  return value->isarr();
+  return kind == ARR;
 }
 
 vector<JSON>& JSON::arr() {
-  return value->arr();
+  return array;
 }
 
 const vector<JSON>& JSON::arr() const {
-  return value->arr();
+  return array;
 }
 
 void JSON::push_back(const JSON& val) {
-  value->push_back(val);
+  array.push_back(val);
 }
 
 void JSON::push_back(JSON&& val) {
-  value->push_back(move(val));
+  array.push_back(move(val));
 }
 
 JSON& JSON::operator[](size_t i) {
-  return (*value)[i];
+  return array[i];
 }
 
 const JSON& JSON::operator[](size_t i) const {
-  return (*value)[i];
+  return array[i];
 }
 
 vector<JSON>::iterator JSON::erase(vector<JSON>::iterator position) {
-  return value->erase(position);
+  return array.erase(position);
 }
 
 vector<JSON>::iterator JSON::erase(
   vector<JSON>::iterator first,
   vector<JSON>::iterator last
 ) {
-  return value->erase(first,last);
+  return array.erase(first,last);
 }
 
 bool JSON::istrue() const {
-  return value->isstr() && value->str() == "true";
+  return isstr() && scalar.text == "true";
 }
 
 bool JSON::isfalse() const {
-  return value->isstr() && value->str() == "false";
+  return isstr() && scalar.text == "false";
 }
 
 bool JSON::isnull() const {
-  return value->isstr() && value->str() == "null";
+  return isstr() && scalar.text == "null";
 }
 
 void JSON::settrue() {
@@ -603,18 +400,40 @@ void JSON::setnull() {
 }
 
 JSON::operator bool() const {
-  if (!value->isstr()) return true;
-  auto s = value->str();
+  if (!isstr()) return true;
+  const string& s = scalar.text;
   if (s == "" || is_json_zero(s) || s == "false" || s == "null") return false;
   return true;
 }
 
 size_t JSON::size() const {
-  return value->size();
+  switch (kind) {
+    case OBJ: return object.size();
+    case ARR: return array.size();
+    default:  return scalar.text.size();
+  }
 }
 
 bool JSON::equals(const JSON& o) const {
-  return value->equals(o);
+  switch (kind) {
+    case OBJ: {
+      if (!o.isobj() || object.size() != o.size()) return false;
+      auto j = o.object.begin();
+      for (auto i = object.begin(); i != object.end(); i++, j++) {
+        if (i->first != j->first || !i->second.equals(j->second)) return false;
+      }
+      return true;
+    }
+    case ARR: {
+      if (!o.isarr() || array.size() != o.size()) return false;
+      for (int i = 0; i < array.size(); i++) {
+        if (!array[i].equals(o.array[i])) return false;
+      }
+      return true;
+    }
+    default:
+      return o.isstr() && scalar.text == o.scalar.text;
+  }
 }
 
 const JSON JSON::operator()() const {
@@ -626,82 +445,134 @@ JSON& JSON::ref() {
 }
 
 bool JSON::parse(void* src) {
-  stringstream ss((char*)src);
-  return ss >> *this;
+  return parse_json((const char*)src,strlen((const char*)src),*this);
 }
 
 bool JSON::parse(const string& src) {
-  stringstream ss(src);
-  return ss >> *this;
+  return parse_json(src.c_str(),src.size(),*this);
 }
 
 bool JSON::read_file(const string& fn) {
-  ifstream f(fn.c_str());
-  return f >> *this;
+  string buf;
+  int fd = ::open(fn.c_str(),O_RDONLY|O_CLOEXEC);
+  if (fd < 0) return parse(buf);
+  struct stat st;
+  if (!fstat(fd,&st)) buf.reserve(st.st_size);
+  char tmp[1<<16];
+  for (ssize_t n; (n = ::read(fd,tmp,sizeof tmp)) != 0;) {
+    if (n < 0) { if (errno == EINTR) continue; break; }
+    buf.append(tmp,n);
+  }
+  ::close(fd);
+  return parse(buf);
+}
+
+bool JSON::put(
+  string& buf,
+  const function<bool(string&)>& flush,
+  unsigned indent
+) const {
+  switch (kind) {
+    case STR: to_json(scalar.text,buf); break;
+    case NUM:
+    case LIT: buf += scalar.text;       break;
+    case OBJ: {
+      buf += "{"; if (indent) buf += "\n";
+      auto cnt = object.size();
+      for (auto it = object.begin(); it != object.end(); it++) {
+        for (int i = 0; i < indent; i++) buf += "  ";
+        to_json(it->first,buf,true);
+        buf += ": ";
+        if (!it->second.put(buf,flush,indent ? indent+1 : 0)) return false;
+        cnt--;
+        if (cnt > 0) buf += ",";
+        if (indent) buf += "\n";
+      }
+      if (indent) for (int i = 0; i < indent-1; i++) buf += "  ";
+      buf += "}";
+      break;
+    }
+    case ARR: {
+      buf += "["; if (indent) buf += "\n";
+      for (int i = 0; i < array.size(); i++) {
+        for (int i = 0; i < indent; i++) buf += "  ";
+        if (!array[i].put(buf,flush,indent ? indent+1 : 0)) return false;
+        if (i < array.size()-1) buf += ",";
+        if (indent) buf += "\n";
+      }
+      if (indent) for (int i = 0; i < indent-1; i++) buf += "  ";
+      buf += "]";
+      break;
+    }
+  }
+  return !flush || buf.size() < (1<<16) || flush(buf);
 }
 
 string JSON::generate(unsigned indent) const {
-  return value->generate(indent);
+  string ans;
+  put(ans,nullptr,indent);
+  return ans;
+}
+
+bool JSON::generate(
+  string& buf,
+  const function<bool(string&)>& flush,
+  unsigned indent
+) const {
+  return put(buf,flush,indent);
 }
 
 bool JSON::write_file(const string& fn, unsigned indent) const {
-  ofstream f(fn.c_str());
-  if (!(f << value->generate(indent))) return false;
-  if (indent) f << endl;
-  return true;
+  int fd = ::open(fn.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+  if (fd < 0) return false;
+  auto flush = [=](string& buf) {
+    for (size_t i = 0; i < buf.size();) {
+      ssize_t n = ::write(fd,buf.c_str()+i,buf.size()-i);
+      if (n < 0 && errno != EINTR) return false;
+      if (n > 0) i += n;
+    }
+    buf.clear();
+    return true;
+  };
+  string buf;
+  bool ok = put(buf,flush,indent);
+  if (ok && indent) buf += "\n";
+  ok = ok && flush(buf);
+  return ::close(fd) == 0 && ok;
 }
 
 ostream& operator<<(ostream& os, const JSON& json) {
-  return os << json.generate(1);
+  string buf;
+  json.generate(buf,[&](string& buf) {
+    os.write(buf.c_str(),buf.size());
+    buf.clear();
+    return bool(os);
+  },1);
+  return os.write(buf.c_str(),buf.size());
 }
 
 // =============================================================================
 // functions for parsing, generating, encoding and decoding
 // =============================================================================
 
-// just a wrapper for vector<uint8_t> to ensure that clear() won't free memory
-class Buffer {
-  public:
-    Buffer() : sz(0) {}
-    const uint8_t& operator[](size_t i) const { return buf[i]; }
-    size_t size() const { return sz; }
-    void push(uint8_t x) {
-      if (sz < buf.size()) buf[sz++] = x;
-      else {
-        buf.push_back(x);
-        sz = buf.size();
-      }
-    }
-    void clear() {
-      sz = 0;
-    }
-  private:
-    size_t sz;
-    vector<uint8_t> buf;
-};
+// the parser: a single pass over a NUL terminated buffer, building the tree
+// in place. a JSON ends at the end of the line where its value ends, but the
+// rest of that line must still be made of valid tokens
 
 enum {STRING=1,NUMBER,LITERAL,ERROR};
-struct Token {
-  char type;
-  string data;
-  Token(char type) : type(type) {}
-  Token(char type, string&& d) : type(type) { data = move(d); }
-};
 
-static char* parse_escaped_unicode(
-  char* s, string& buf, string& error, int hi = -1
+static const char* parse_escaped_unicode(
+  const char* s, string& buf, string& error, int hi = -1
 ) {
-  // check 4 hex digits
-  for (int i = 0; i < 4; i++) if (!isxdigit(s[i])) {
-    error = "lexical error: invalid escaping";
-    return s;
-  }
   // read 4 hex digits
-  char tmp = s[4];
-  s[4] = 0;
-  int u;
-  sscanf(s,"%x",&u);
-  s[4] = tmp;
+  int u = 0;
+  for (int i = 0; i < 4; i++) {
+    if (!isxdigit(s[i])) {
+      error = "lexical error: invalid escaping";
+      return s;
+    }
+    u = (u<<4)|(isdigit(s[i]) ? s[i]-'0' : (tolower(s[i])-'a'+10));
+  }
   s += 3;
   // high surrogate area
   if (0xd800 <= u && u <= 0xdbff) {
@@ -722,10 +593,27 @@ static char* parse_escaped_unicode(
 }
 
 static const uint8_t* parse_string(
-  const uint8_t* s, vector<Token>& tks, string& error
+  const uint8_t* s, const uint8_t* end, string& str, string& error
 ) {
-  string str;
-  for (; *s && *s != '"'; s++) {
+  for (; *s && *s != '"' && *s != '\r' && *s != '\n'; s++) {
+#ifdef __SSE2__
+    // copy runs of printable ASCII without quotes or escapes 16 bytes at a
+    // time. bytes from 0x80 are negative, so they are compared as controls
+    const __m128i quote = _mm_set1_epi8('"'), bslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(' ');
+    while (end-s >= 16) {
+      __m128i x = _mm_loadu_si128((const __m128i*)s);
+      int mask = _mm_movemask_epi8(_mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(x,quote),_mm_cmpeq_epi8(x,bslash)),
+        _mm_cmplt_epi8(x,space)
+      ));
+      int n = (mask ? __builtin_ctz(mask) : 16);
+      str.append((const char*)s,n);
+      s += n;
+      if (mask) break;
+    }
+    if (*s == 0 || *s == '"' || *s == '\r' || *s == '\n') break;
+#endif
     // unescaped
     if (*s != '\\') {
       if (isctl(*s)) {
@@ -760,47 +648,53 @@ static const uint8_t* parse_string(
         return s;
     }
   }
-  if (*s == '"') tks.emplace_back(STRING,move(str));
-  else error = "lexical error: expected '\"' before end of line";
+  if (*s != '"') error = "lexical error: expected '\"' before end of line";
   return s;
 }
 
-static void lexical_error(const char* s, string& error) {
-  error  = "lexical error: invalid token '";
-  error += s;
-  error += "'";
-}
-
-static const char* parse_literal(
-  string lit,
-  const char* s, vector<Token>& tks, string& error
-) {
-  if (strncmp(lit.c_str(),s,lit.size())) { lexical_error(s,error); return s; }
-  auto ans = s+lit.size()-1;
-  tks.emplace_back(LITERAL,move(lit));
-  return ans;
-}
-
-static const char* parse_number(
-  const char* s, vector<Token>& tks, string& error
-) {
-  auto len = json_number_length(s);
-  if (!len) { lexical_error(s,error); return s; }
-  string num;
-  for (int i = 0; i < len; i++) num += s[i];
-  tks.emplace_back(NUMBER,move(num));
-  return s+len-1;
-}
-
-// NFA for lexical analysis
-static vector<Token> tokens(const char* s, string& error) {
-  vector<Token> ans;
-  for (; *s && error == ""; s++) {
-    switch (*s) {
-      // whitespaces
-      case ' ' :
-      case '\t':
-        break;
+enum {OBJECT=1,KEY,COLON,VALUE,MEMBERS,ARRAY,ELEMENTS};
+struct Parser {
+  const char* s; // next char
+  const char* end;
+  int ln;
+  string error;
+  int state;
+  vector<JSON*> S; // open objects and arrays
+  JSON* root;
+  string data,key;
+  Parser(const char* s, size_t n, JSON& root) :
+  s(s), end(s+n), ln(1), state(VALUE), root(&root) {}
+  void lexical_error() {
+    const char* e = s;
+    while (e < end && *e != '\r' && *e != '\n') e++;
+    error  = "lexical error: invalid token '";
+    error.append(s,e);
+    error += "'";
+  }
+  // next token, with its text in data. 0 at the end of the input or, if
+  // line_only, at the end of the line
+  char token(bool line_only = false) {
+    for (;; s++) {
+      switch (*s) {
+        case ' ' :
+        case '\t':
+          continue;
+        case '\r':
+        case '\n':
+          if (line_only) return 0;
+          if (*s == '\r' && s[1] == '\n') s++;
+          ln++;
+          continue;
+      }
+      break;
+    }
+    if (s == end) return 0;
+    char c = *s++;
+    data.clear();
+    switch (c) {
+      case 0:
+        error = "character NUL is illegal";
+        return ERROR;
       // structural characters
       case '[':
       case '{':
@@ -808,150 +702,113 @@ static vector<Token> tokens(const char* s, string& error) {
       case '}':
       case ':':
       case ',':
-        ans.emplace_back(*s);
-        break;
+        return c;
       // strings
       case '"':
-        s = (const char*)parse_string((const uint8_t*)s+1,ans,error);
-        break;
+        s = (const char*)parse_string(
+          (const uint8_t*)s,(const uint8_t*)end,data,error
+        );
+        if (error != "") return ERROR;
+        s++;
+        return STRING;
       // literals
-      case 't': s = parse_literal("true" ,s,ans,error); break;
-      case 'f': s = parse_literal("false",s,ans,error); break;
-      case 'n': s = parse_literal("null" ,s,ans,error); break;
-      // numbers
-      default:  s = parse_number(s,ans,error);
+      case 't':
+      case 'f':
+      case 'n': {
+        const char* lit = (c == 't' ? "true" : c == 'f' ? "false" : "null");
+        size_t len = strlen(lit);
+        s--;
+        if (strncmp(lit,s,len)) { lexical_error(); return ERROR; }
+        data.assign(s,len);
+        s += len;
+        return LITERAL;
+      }
     }
-  }
-  return ans;
-}
-
-enum {OBJECT=1,KEY,COLON,VALUE,MEMBERS,ARRAY,ELEMENTS};
-struct PDA {
-  int state;
-  stack<JSON> S;
-  JSON json;
-  PDA() : state(VALUE) {}
-  void push_obj() {
-    state = OBJECT;
-    S.emplace();
-  }
-  void push_key(string&& key) {
-    state = COLON;
-    S.emplace(move(key));
-  }
-  void push_arr() {
-    state = ARRAY;
-    S.emplace(vector<JSON>());
-  }
-  void pop() {
-    json = move(S.top()); S.pop();
-    settle();
-  }
-  void value(string&& val) {
-    json = move(val);
-    settle();
+    // numbers
+    s--;
+    size_t len = json_number_length(s);
+    if (!len) { lexical_error(); return ERROR; }
+    data.assign(s,len);
+    s += len;
+    return NUMBER;
+  }
+  JSON& slot() { // where the next value goes
+    if (S.empty()) return *root;
+    JSON& top = *S.back();
+    if (top.isobj()) return top[move(key)];
+    top.arr().emplace_back();
+    return top.arr().back();
   }
   void settle() {
-    if (S.size() == 0) state = 0;
-    else if (S.top().isstr()) {
-      state = MEMBERS;
-      string key = move(S.top()); S.pop();
-      S.top()[move(key)] = move(json);
-    }
-    else {
-      state = ELEMENTS;
-      S.top().push_back(move(json));
-    }
+    if (S.empty()) state = 0;
+    else state = (S.back()->isobj() ? MEMBERS : ELEMENTS);
   }
-  void process(Token&& token, string& error) {
+  void process(char token) {
     switch (state) {
       case OBJECT:
-        if (token.type == '}') pop();
-        else if (token.type == STRING) push_key(move(token.data));
+        if (token == '}') { S.pop_back(); settle(); }
+        else if (token == STRING) { key = move(data); state = COLON; }
         else error = "syntax error: expected '}' or key";
         break;
       case KEY:
-        if (token.type == STRING) push_key(move(token.data));
+        if (token == STRING) { key = move(data); state = COLON; }
         else error = "syntax error: expected key";
         break;
       case COLON:
-        if (token.type == ':') state = VALUE;
+        if (token == ':') state = VALUE;
         else error = "syntax error: expected ':'";
         break;
       case VALUE:
-L_VAL:  if (token.type == '{') push_obj();
-        else if (token.type == '[') push_arr();
-        else if (token.type < ERROR) value(move(token.data));
+L_VAL:  if (token == '{') {
+          JSON& val = slot();
+          val = JSON();
+          S.push_back(&val);
+          state = OBJECT;
+        }
+        else if (token == '[') {
+          JSON& val = slot();
+          val = vector<JSON>();
+          S.push_back(&val);
+          state = ARRAY;
+        }
+        else if (token < ERROR) { slot() = move(data); settle(); }
         else error = "syntax error: expected value";
         break;
       case MEMBERS:
-        if (token.type == '}') pop();
-        else if (token.type == ',') state = KEY;
+        if (token == '}') { S.pop_back(); settle(); }
+        else if (token == ',') state = KEY;
         else error = "syntax error: expected '}' or ','";
         break;
       case ARRAY:
-        if (token.type == ']') pop();
+        if (token == ']') { S.pop_back(); settle(); }
         else goto L_VAL;
         break;
       case ELEMENTS:
-        if (token.type == ']') pop();
-        else if (token.type == ',') state = VALUE;
+        if (token == ']') { S.pop_back(); settle(); }
+        else if (token == ',') state = VALUE;
         else error = "syntax error: expected ']' or ','";
         break;
     }
   }
-};
-
-// the parser
-static bool operator>>(istream& is, JSON& json) {
-  int ln = 1;
-  // function to return error
-  auto error = [&](const string& msg) {
+  bool parse() {
+    if (s == end) error = "empty input";
+    while (error == "" && state) {
+      char t = token();
+      if (error != "") break;
+      process(t ? t : ERROR);
+      if (!t) break;
+    }
+    while (error == "" && token(true)); // the rest of the line
+    if (error == "") return true;
     stringstream ss;
-    ss << "line " << ln << ": " << msg;
-    json = move(ss.str());
+    ss << "line " << ln << ": " << error;
+    *root = move(ss.str());
     return false;
-  };
-  uint8_t c = is.get();
-  if (!is) return error("empty input");
-  Buffer buf;
-  buf.push(c);
-  PDA pda;
-  string err;
-  for (;;ln++) { // for each line
-    // read line
-    uint8_t c = buf[0]; // first byte of a line is always at buf[0]
-    for (buf.clear(); is && c && c!='\r' && c!='\n'; c = is.get()) buf.push(c);
-    if (is) {
-      if (!c) return error("character NUL is illegal");
-      if (buf.size() == 0) continue; // empty line
-    }
-    buf.push(0);
-    // lexical analysis
-    vector<Token> tks = move(tokens((const char*)&buf[0],err));
-    if (err != "") return error(err);
-    // parsing
-    for (int i = 0; i < tks.size() && pda.state; i++) {
-      pda.process(move(tks[i]),err);
-      if (err != "") return error(err);
-    }
-    if (!pda.state) break; // parsing done, there is a JSON to return
-    // fix buffer
-    buf.clear();
-    if (!is) { pda.process(Token(ERROR),err); break; }
-    if (c == '\r') { // looking for LF after CR
-      c = is.get();
-      if (!is) { pda.process(Token(ERROR),err); break; }
-      if (c != '\n') { buf.push(c); continue; } // no LF, just another char
-    }
-    // at this point, c is an LF for sure. check if there is some input left
-    c = is.get();
-    if (!is) { pda.process(Token(ERROR),err); break; } // no, there isn't
-    buf.push(c); // yes, there is
   }
-  if (err != "") return error(err);
-  json = move(pda.json);
-  return true;
+};
+
+static bool parse_json(const char* src, size_t n, JSON& json) {
+  return Parser(src,n,json).parse();
 }
 
 // true only if val is a JSON number with value equal to zero
@@ -1062,14 +919,14 @@ static void encode_utf8(unsigned cpt, string& buf) {
   for (cdu[6] = 0; cdu[6] < cdu[7]; cdu[6]++) buf += cdu[cdu[6]];
 }
 
-static string to_json(const string& val, bool force) {
+static void to_json(const string& val, string& ans, bool force) {
   if (
     !force &&
     (val.size() > 0 && json_number_length(val.c_str()) == val.size()) || // num
     val == "true" || val == "false" || val == "null" // literal
-  ) return val;
+  ) { ans += val; return; }
   // string
-  string ans = "\"";
+  ans += '"';
   for (const uint8_t* s = (const uint8_t*)val.c_str(); *s; s++) {
     switch (*s) {
       case '"' :  ans += "\\\"";  break; //    quotation mark mandatory escape
@@ -1089,5 +946,5 @@ static string to_json(const string& val, bool force) {
       }
     }
   }
-  return ans+"\"";
+  ans += '"';
 }
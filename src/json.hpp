@@ -5,8 +5,14 @@
 #include <map>
 #include <vector>
 #include <sstream>
+#include <functional>
+#include <type_traits>
 
-struct JSONValue; // hidden class for implementation
+template <typename T> // integers stored as numbers, unlike characters
+struct json_integral : std::integral_constant<bool,
+  std::is_integral<T>::value &&
+  (std::is_same<T,bool>::value || sizeof(T) > sizeof(char))
+> {};
 class JSON {
   // API
   public:
@@ -39,16 +45,22 @@ class JSON {
     JSON& operator=(std::string&&);
     // number constructors
     template <typename T>
-    JSON(T val) : value(nullptr) {
-      std::stringstream ss;
-      ss << val;
-      operator=(move(ss.str()));
+    JSON(T val) : JSON() {
+      operator=(val);
+    }
+    template <typename T>
+    typename std::enable_if<json_integral<T>::value,JSON&>::type
+    operator=(T val) {
+      set((long long)val,std::is_signed<T>::value);
+      return *this;
     }
+    JSON& operator=(double);
     template <typename T>
-    JSON& operator=(T val) {
+    typename std::enable_if<!json_integral<T>::value,JSON&>::type
+    operator=(T val) {
       std::stringstream ss;
       ss << val;
-      operator=(move(ss.str()));
+      return operator=(move(ss.str()));
     }
     // object constructors
     JSON(const std::map<std::string,JSON>&);
@@ -73,14 +85,16 @@ class JSON {
     number num() const;
     template <typename T>
     operator T() const {
-      std::stringstream ss(str());
       T ans;
+      if (get(ans)) return ans;
+      std::stringstream ss(str());
       ss >> ans;
       return ans;
     }
     template <typename T>
     bool read(T& buf) const {
       if (!isnum()) return false;
+      if (get(buf)) return true;
       std::stringstream ss(str());
       if (!(ss >> buf)) return false;
       ss.get();
@@ -159,10 +173,57 @@ class JSON {
     bool parse(const std::string&);
     bool read_file(const std::string&);
     std::string generate(unsigned indent = 0) const; // 0 generates compact JSON
+    // appends to buf, calling flush(buf) whenever buf grows past 64 kB. flush
+    // must consume buf, or return false to stop the generation
+    bool generate(
+      std::string& buf,
+      const std::function<bool(std::string&)>& flush,
+      unsigned indent = 0
+    ) const;
     bool write_file(const std::string&, unsigned indent = 1) const;
   // implementation
   private:
-    JSONValue* value;
+    struct Scalar { // strings, numbers and literals
+      std::string text;
+      long long i; // if isint
+      double d; // if a number
+    };
+    char kind;
+    bool isint; // a number that fits in scalar.i
+    union {
+      Scalar scalar;
+      std::map<std::string,JSON> object;
+      std::vector<JSON> array;
+    };
+    void destroy();
+    bool put(
+      std::string&,
+      const std::function<bool(std::string&)>&,
+      unsigned indent
+    ) const;
+    // numbers keep their value next to their text, so reading integers and
+    // doubles needs no stringstream
+    void set(long long, bool is_signed);
+    bool integer(long long&) const; // false if not a long long number
+    bool real(double&) const; // false if not a number
+    template <typename T>
+    typename std::enable_if<json_integral<T>::value,bool>::type
+    get(T& buf) const {
+      long long x;
+      if (!integer(x) || x != (long long)T(x) || (x < 0) != (T(x) < 0)) {
+        return false;
+      }
+      buf = T(x);
+      return true;
+    }
+    template <typename T>
+    typename std::enable_if<!json_integral<T>::value,bool>::type
+    get(T&) const {
+      return false;
+    }
+    bool get(double& buf) const {
+      return real(buf);
+    }
 };
 // more API
 bool operator==(const std::string&, const JSON&);
@@ -1,7 +1,17 @@
+#include <set>
 #include <queue>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <cerrno>
+#include <cstdio>
 
+#include <sched.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
@@ -9,12 +19,137 @@
 
 #include "judge.hpp"
 
+#include "cache.hpp"
+#include "checker.hpp"
 #include "database.hpp"
 #include "helper.hpp"
 #include "language.hpp"
+#include "launcher.hpp"
+#include "scoreboard.hpp"
 
 using namespace std;
 
+// settings
+static JSON settings;
+template <typename T, typename... Args>
+inline T setting(T def, Args... args) {
+  return settings(args...).to(def);
+}
+
+// cores: each solution runs alone in a leased core, while everything else
+// (web server, database, judge workers and compilers) shares the housekeeping
+// cores. leasing is disabled if there are not enough cores.
+struct Core {
+  int cpu;
+  bool busy;
+  unsigned runs;
+  double busy_time; // seconds
+  timeval since;
+};
+static vector<Core> cores;
+static vector<int> housekeeping;
+static timeval cores_start;
+static time_t cores_report = 0;
+static pthread_mutex_t cores_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cores_cond = PTHREAD_COND_INITIALIZER;
+static double elapsed(const timeval& a, const timeval& b) {
+  return (b.tv_sec-a.tv_sec) + (b.tv_usec-a.tv_usec)/1e6;
+}
+static cpu_set_t cpu_mask(const vector<int>& cpus) { // empty: not pinned
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) CPU_SET(cpu,&set);
+  return set;
+}
+static void pin(pid_t tid, const vector<int>& cpus) {
+  cpu_set_t set = cpu_mask(cpus);
+  sched_setaffinity(tid,sizeof set,&set);
+}
+static void init_cores() {
+  cpu_set_t set;
+  if (sched_getaffinity(0,sizeof set,&set) < 0) return;
+  vector<int> allowed;
+  for (int i = 0; i < CPU_SETSIZE; i++) if (CPU_ISSET(i,&set)) {
+    allowed.push_back(i);
+  }
+  int nhk = setting(1,"housekeeping_cpus");
+  if (nhk < 1 || int(allowed.size()) <= nhk) return;
+  housekeeping.assign(allowed.begin(),allowed.begin()+nhk);
+  for (auto it = allowed.begin()+nhk; it != allowed.end(); it++) {
+    cores.push_back(Core{*it,false,0,0,timeval()});
+  }
+  // move the threads we already have; the new ones inherit the affinity
+  DIR* dir = opendir("/proc/self/task");
+  if (dir) {
+    for (dirent* ent = readdir(dir); ent; ent = readdir(dir)) {
+      if (ent->d_name[0] != '.') pin(atoi(ent->d_name),housekeeping);
+    }
+    closedir(dir);
+  }
+  gettimeofday(&cores_start,nullptr);
+}
+static void report_cores() { // call with the mutex locked
+  timeval now;
+  gettimeofday(&now,nullptr);
+  double total = elapsed(cores_start,now);
+  JSON ans(map<string,JSON>{
+    {"since"        , cores_start.tv_sec},
+    {"housekeeping" , vector<JSON>(housekeeping.begin(),housekeeping.end())},
+    {"cores"        , vector<JSON>{}}
+  });
+  for (auto& core : cores) {
+    double busy = core.busy_time;
+    if (core.busy) busy += elapsed(core.since,now);
+    ans["cores"].push_back(map<string,JSON>{
+      {"cpu"          , core.cpu},
+      {"runs"         , core.runs},
+      {"busy"         , busy},
+      {"utilization"  , total > 0 ? 100*busy/total : 0.0}
+    });
+  }
+  ans.write_file("cores.json");
+  cores_report = now.tv_sec;
+}
+static int lease() { // -1 if leasing is disabled
+  if (cores.empty()) return -1;
+  pthread_mutex_lock(&cores_mutex);
+  for (;;) {
+    for (int i = 0; i < int(cores.size()); i++) if (!cores[i].busy) {
+      cores[i].busy = true;
+      gettimeofday(&cores[i].since,nullptr);
+      pthread_mutex_unlock(&cores_mutex);
+      return i;
+    }
+    pthread_cond_wait(&cores_cond,&cores_mutex);
+  }
+}
+static void release(int i) {
+  if (i < 0) return;
+  timeval now;
+  gettimeofday(&now,nullptr);
+  pthread_mutex_lock(&cores_mutex);
+  auto& core = cores[i];
+  core.busy = false;
+  core.runs++;
+  core.busy_time += elapsed(core.since,now);
+  if (cores_report + 10 <= now.tv_sec) report_cores();
+  pthread_cond_signal(&cores_cond);
+  pthread_mutex_unlock(&cores_mutex);
+}
+
+// cgroups: each run gets a cgroup of its own under this directory, if the
+// launcher can enable the memory and pids controllers there
+static string cgroup_dir() {
+  JSON path = settings("cgroup","path");
+  if (path.isstr() && !path.isnull()) return path; // "" disables cgroups
+  ifstream f("/proc/self/mounts");
+  for (string dev, dir, type, rest; f >> dev >> dir >> type;) {
+    if (type == "cgroup2") return dir+"/pjudge";
+    getline(f,rest);
+  }
+  return "";
+}
+
 // %p = path
 // %s = source
 // %P = problem
@@ -38,39 +173,87 @@ static string command(
   return cmd;
 }
 
-static char run(const string& cmd, int tls, int mlkB, int& mtms, int& mmkB) {
-  // init time
-  timeval start;
-  gettimeofday(&start,nullptr);
+static long long now() { // milliseconds
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec*1000LL + ts.tv_nsec/1000000;
+}
+
+// a verdict, or -1 if the judge couldn't run or check the solution
+static int run(
+  const string& cmd,
+  const string& ifn,
+  Checker::Stream& out,
+  int tls,
+  int mlkB,
+  long long& cpuus,
+  long long& wallus,
+  int& mmkB
+) {
+  cpuus = wallus = mmkB = 0;
+  // stdin from the input file, stdout through the checker
+  int in = open(ifn.c_str(),O_RDONLY|O_CLOEXEC), fds[2];
+  if (in < 0) return -1;
+  if (pipe2(fds,O_CLOEXEC) < 0) { close(in); return -1; }
   // child
-  pid_t pid = fork();
-  if (!pid) {
-    tls++;
-    rlimit r;
-    r.rlim_cur = tls;
-    r.rlim_max = tls;
-    setrlimit(RLIMIT_CPU,&r);
-    r.rlim_cur = RLIM_INFINITY;
-    r.rlim_max = RLIM_INFINITY;
-    setrlimit(RLIMIT_STACK,&r);
-    execl("/bin/sh","/bin/sh","-c",cmd.c_str(),(char*)0);
-    _exit(-1);
-  }
+  int core = lease();
+  pid_t pid;
+  Launcher::Limits lim;
+  lim.cpus = cpu_mask(core < 0 ? vector<int>() : vector<int>{cores[core].cpu});
+  lim.cpu_time = tls+1;
+  lim.wall_time = 1000*tls*max(1,setting(2,"wall_time_factor"));
+  lim.memory = mlkB;
+  lim.pids = setting(256,"cgroup","pids_max");
+  int handle = Launcher::spawn(cmd,in,fds[1],lim,pid);
   // parent
-  int st;
-  rusage r;
-  wait4(pid,&st,0,&r);
-  long long us = 0;
-  us += r.ru_utime.tv_sec*1000000L;
-  us += r.ru_utime.tv_usec;
-  us += r.ru_stime.tv_sec*1000000L;
-  us += r.ru_stime.tv_usec;
-  mtms = us/1000;
+  close(in);
+  close(fds[1]);
+  if (handle < 0) {
+    close(fds[0]);
+    release(core);
+    return -1;
+  }
+  // read until eof, or until a bit after the wall time limit: something the
+  // run detached from its process group may keep the pipe open
+  bool wrong = false, late = false;
+  static const size_t bufsize = 1<<16;
+  unique_ptr<char[]> buf(new char[bufsize]);
+  long long deadline = now()+lim.wall_time+1000;
+  for (ssize_t n; !wrong && !late;) {
+    pollfd pfd = {fds[0],POLLIN,0};
+    int timeout = (lim.wall_time > 0 ? max(0LL,deadline-now()) : -1);
+    int ready = poll(&pfd,1,timeout);
+    if (ready == 0) { late = true; kill(-pid,SIGKILL); continue; }
+    if (ready < 0 || (n = read(fds[0],buf.get(),bufsize)) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (n == 0) break;
+    if (!out.write(buf.get(),n)) {
+      wrong = true;
+      kill(-pid,SIGKILL);
+    }
+  }
+  close(fds[0]);
+  Launcher::Result res;
+  bool ok = Launcher::wait(handle,res);
+  release(core);
+  if (!ok) return -1;
+  auto& r = res.usage;
+  cpuus += r.ru_utime.tv_sec*1000000LL;
+  cpuus += r.ru_utime.tv_usec;
+  cpuus += r.ru_stime.tv_sec*1000000LL;
+  cpuus += r.ru_stime.tv_usec;
+  if (res.cpu >= 0) cpuus = res.cpu; // includes everything the run forked
+  wallus = res.wall;
   mmkB = r.ru_maxrss;
-  if (mtms > tls*1000) return TLE;
+  int st = res.status;
+  if (wrong) return WA;
+  if (res.oom) return MLE;
+  if (late || res.timeout || cpuus > tls*1000000LL) return TLE;
   if (mmkB > mlkB) return MLE;
   if (!WIFEXITED(st) || WEXITSTATUS(st) || WIFSIGNALED(st)) return RTE;
-  return AC;
+  return out.close();
 }
 
 static void judge(int attid) {
@@ -91,8 +274,18 @@ static void judge(int attid) {
   
   // compile
   if (settings("compile")) {
-    int status = system(command(settings["compile"],path,prob,lang).c_str());
-    if (WEXITSTATUS(status)) {
+    string key = settings["compile"].str()+'\0'+prob+'\0'+lang+'\0';
+    ifstream src((path+"/"+prob+lang).c_str(),ios::binary);
+    key.append(istreambuf_iterator<char>(src),istreambuf_iterator<char>());
+    int status = Cache::compile(
+      key,command(settings["compile"],path,prob,lang),path
+    );
+    if (status == -1) {
+      att["status"] = "cantjudge";
+      attempts.update(attid,move(att));
+      return;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
       att["status"] = "judged"; // CE needs no judgement by humans
       att["verdict"] = verdict_tos(CE);
       attempts.update(attid,move(att));
@@ -102,7 +295,8 @@ static void judge(int attid) {
   
   // get execution settings
   string cmd = command(settings["run"],path,prob,lang);
-  int Mtms=0,MmkB=0,mtms,mmkB;
+  long long Mcpuus=0,Mwallus=0,cpuus,wallus;
+  int MmkB=0,mmkB;
   int tls = settings["timelimit"], mlkB = settings["memlimit"];
   
   // init attempt
@@ -111,8 +305,20 @@ static void judge(int attid) {
   );
   int verd = AC;
   
-  // for each input file
+  // get checker settings
   string dn = "problems/"+prob;
+  DB(problems);
+  JSON checker = problems.retrieve(int(att["problem"]))("checker");
+  if (checker("path")) checker["path"] = dn+"/"+checker["path"].str();
+  // external checkers run like solutions, but share the housekeeping cores
+  Launcher::Limits chklim; // with the compilers
+  chklim.cpus = cpu_mask(housekeeping);
+  chklim.cpu_time = checker("timelimit").to(10);
+  chklim.wall_time = 1000*chklim.cpu_time*max(1,setting(2,"wall_time_factor"));
+  chklim.memory = mlkB;
+  chklim.pids = setting(256,"cgroup","pids_max");
+  
+  // for each input file
   DIR* dir = opendir((dn+"/input").c_str());
   for (dirent* ent = readdir(dir); ent; ent = readdir(dir)) {
     string fn = ent->d_name;
@@ -123,48 +329,65 @@ static void judge(int attid) {
     stat(ifn.c_str(),&stt);
     if (!S_ISREG(stt.st_mode)) continue;
     
-    // run
-    string ofn = path+"/output/"+fn;
-    verd = run(cmd+" < "+ifn+" > "+ofn,tls,mlkB,mtms,mmkB);
-    Mtms = max(Mtms,mtms);
+    // run and check
+    Checker::Stream out(
+      checker,ifn,dn+"/output/"+fn,path+"/output/"+fn,chklim
+    );
+    verd = run(cmd,ifn,out,tls,mlkB,cpuus,wallus,mmkB);
+    Mcpuus = max(Mcpuus,cpuus);
+    Mwallus = max(Mwallus,wallus);
     MmkB = max(MmkB,mmkB);
     if (verd != AC) break;
-    
-    // diff
-    string sfn = dn+"/output/"+fn;
-    int status = system("diff -wB %s %s",ofn.c_str(),sfn.c_str());
-    if (WEXITSTATUS(status)) { verd = WA; break; }
-    status = system("diff %s %s",ofn.c_str(),sfn.c_str());
-    if (WEXITSTATUS(status)) { verd = PE; break; }
-    
-    // remove correct output
-    remove(ofn.c_str());
   }
   closedir(dir);
+  if (verd < 0) { // not the solution's fault
+    att["status"] = "cantjudge";
+    attempts.update(attid,move(att));
+    return;
+  }
   
   // update attempt
   att["verdict"] = verdict_tos(verd);
-  att["time"] = move(tostr(mtms));
-  att["memory"] = move(tostr(mmkB));
+  att["time"] = move(stringf("%.3f",Mcpuus/1000.0)); // ms
+  att["wall_time"] = move(stringf("%.3f",Mwallus/1000.0)); // ms
+  att["memory"] = move(tostr(MmkB));
   attempts.update(attid,move(att));
 }
 
-static queue<int> jqueue;
+// queue: lane 0 (privileged attempts and reruns) goes before lane 1
+static queue<int> jqueue[2];
+static set<int> judging, again; // attempts being judged, and pushed meanwhile
 static bool quit = false;
-static pthread_t jthread;
+static vector<pthread_t> jthreads;
 static pthread_mutex_t judge_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t judge_cond = PTHREAD_COND_INITIALIZER;
+static void enqueue(int attid, bool priority) { // call with the mutex locked
+  jqueue[priority ? 0 : 1].push(attid);
+  pthread_cond_signal(&judge_cond);
+}
 static void* thread(void*) {
-  while (!quit) {
-    pthread_mutex_lock(&judge_mutex);
-    if (jqueue.empty()) {
-      pthread_mutex_unlock(&judge_mutex);
-      usleep(25000);
+  pthread_mutex_lock(&judge_mutex);
+  for (;;) {
+    while (!quit && jqueue[0].empty() && jqueue[1].empty()) {
+      pthread_cond_wait(&judge_cond,&judge_mutex);
+    }
+    if (quit) break;
+    auto& q = jqueue[jqueue[0].empty() ? 1 : 0];
+    int attid = q.front(); q.pop();
+    if (judging.count(attid)) { // another worker has it: judge it again later
+      again.insert(attid);
       continue;
     }
-    int attid = jqueue.front(); jqueue.pop();
+    judging.insert(attid);
     pthread_mutex_unlock(&judge_mutex);
     judge(attid);
+    Scoreboard::update(attid);
+    pthread_mutex_lock(&judge_mutex);
+    judging.erase(attid);
+    if (again.erase(attid)) enqueue(attid,true);
   }
+  pthread_mutex_unlock(&judge_mutex);
+  return nullptr;
 }
 
 namespace Judge {
@@ -174,24 +397,43 @@ void init() {
   JSON tmp = attempts.retrieve(JSON(map<string,JSON>{
     {"status", "queued"}
   }));
-  for (auto& a : tmp.arr()) jqueue.push(a["id"]);
-  pthread_create(&jthread,nullptr,thread,nullptr);
+  for (auto& a : tmp.arr()) enqueue(a["id"],a("privileged") || a("verdict"));
+  if (!settings.read_file("judge.json")) settings = JSON();
+  init_cores();
+  string cg = cgroup_dir();
+  if (cg.size() && !Launcher::cgroup(cg)) {
+    FILE* fp = fopen("log.txt","a");
+    fprintf(fp,"judge: cgroups disabled, can't set up %s\n",cg.c_str());
+    fclose(fp);
+  }
+  Cache::init(setting(256LL,"compile_cache_size")<<20);
+  jthreads.resize(max(1,setting(1,"workers")));
+  for (auto& t : jthreads) pthread_create(&t,nullptr,thread,nullptr);
 }
 
 void close() {
+  pthread_mutex_lock(&judge_mutex);
   quit = true;
-  pthread_join(jthread,nullptr);
+  pthread_cond_broadcast(&judge_cond);
+  pthread_mutex_unlock(&judge_mutex);
+  for (auto& t : jthreads) pthread_join(t,nullptr);
+  pthread_mutex_lock(&cores_mutex);
+  if (!cores.empty()) report_cores();
+  pthread_mutex_unlock(&cores_mutex);
 }
 
-void push(int attid) {
+void push(int attid, bool rerun) {
   DB(attempts);
-  if (attempts.update([](Database::Document& doc) {
+  bool priority = rerun;
+  if (attempts.update([&](Database::Document& doc) {
     if (doc.second["status"] == "queued") return false;
     doc.second["status"] = "queued";
+    if (doc.second("privileged")) priority = true;
     return true;
   },attid)) {
+    Scoreboard::update(attid);
     pthread_mutex_lock(&judge_mutex);
-    jqueue.push(attid);
+    enqueue(attid,priority);
     pthread_mutex_unlock(&judge_mutex);
   }
 }
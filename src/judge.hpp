@@ -5,7 +5,7 @@ namespace Judge {
 
 void init();
 void close();
-void push(int attid);
+void push(int attid, bool rerun = false); // reruns have priority
 
 } // namespace Judge
 
@@ -0,0 +1,392 @@
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+
+#include <sched.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/stat.h>
+
+#include "launcher.hpp"
+
+using namespace std;
+
+// the launcher is a small process forked before pjudge creates any thread.
+// for each request, it forks a monitor that forks and execs the run, sends
+// its pid, waits for it (killing it after the wall time limit) and sends its
+// status and resource usage. if pjudge set a cgroup directory, each run is
+// placed in a cgroup of its own, which limits its memory and tasks and
+// accounts for everything it forks
+
+#define MAX_CMD 4096
+#define MAX_PATH 256
+
+struct Request {
+  Launcher::Limits limits;
+  char cgroup[MAX_PATH];
+  char cmd[MAX_CMD];
+};
+struct Reply {
+  pid_t pid;
+  Launcher::Result result;
+};
+
+static int sock = -1; // pjudge's end of the launcher socket
+static pid_t launcher = 0;
+static pthread_mutex_t sock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static string cgroup_path;
+
+static bool send_fds(int fd, const void* buf, size_t len, int* fds, int n) {
+  iovec iov = {(void*)buf,len};
+  char ctl[CMSG_SPACE(3*sizeof(int))];
+  msghdr msg;
+  memset(&msg,0,sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl;
+  msg.msg_controllen = CMSG_SPACE(n*sizeof(int));
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(n*sizeof(int));
+  memcpy(CMSG_DATA(cmsg),fds,n*sizeof(int));
+  ssize_t ans;
+  while ((ans = sendmsg(fd,&msg,MSG_NOSIGNAL)) < 0 && errno == EINTR);
+  return ans == ssize_t(len);
+}
+
+static ssize_t recv_fds(int fd, void* buf, size_t len, int* fds, int n) {
+  iovec iov = {buf,len};
+  char ctl[CMSG_SPACE(3*sizeof(int))];
+  msghdr msg;
+  memset(&msg,0,sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl;
+  msg.msg_controllen = CMSG_SPACE(n*sizeof(int));
+  ssize_t ans;
+  while ((ans = recvmsg(fd,&msg,MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (
+    ans <= 0 || !cmsg ||
+    cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(n*sizeof(int))
+  ) {
+    if (cmsg && cmsg->cmsg_type == SCM_RIGHTS) { // don't leak what came
+      int* tmp = (int*)CMSG_DATA(cmsg);
+      int m = (cmsg->cmsg_len-CMSG_LEN(0))/sizeof(int);
+      for (int i = 0; i < m; i++) ::close(tmp[i]);
+    }
+    return ans <= 0 ? ans : -1;
+  }
+  memcpy(fds,CMSG_DATA(cmsg),n*sizeof(int));
+  return ans;
+}
+
+static vector<char*> split(char* cmd) { // argv, without a shell if possible
+  vector<char*> argv;
+  if (strpbrk(cmd,"|&;<>()$`\\\"'*?[]#~=%{}\n")) {
+    argv = {(char*)"/bin/sh",(char*)"-c",cmd};
+  }
+  else for (char* tok = strtok(cmd," \t"); tok; tok = strtok(nullptr," \t")) {
+    argv.push_back(tok);
+  }
+  argv.push_back(nullptr);
+  return argv;
+}
+
+static long long now() { // microseconds
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+static bool expire(pid_t pid, int wall_limit) { // true if pid was killed
+  if (wall_limit <= 0) return false;
+#ifdef SYS_pidfd_open
+  int pidfd = syscall(SYS_pidfd_open,pid,0);
+#else
+  int pidfd = -1;
+#endif
+  int tfd = timerfd_create(CLOCK_MONOTONIC,TFD_CLOEXEC);
+  itimerspec its;
+  memset(&its,0,sizeof its);
+  its.it_value.tv_sec = wall_limit/1000;
+  its.it_value.tv_nsec = (wall_limit%1000)*1000000L;
+  timerfd_settime(tfd,0,&its,nullptr);
+  bool ans = false;
+  for (;;) {
+    if (pidfd >= 0) {
+      pollfd fds[2] = {{pidfd,POLLIN,0},{tfd,POLLIN,0}};
+      if (poll(fds,2,-1) < 0) continue;
+      if (fds[0].revents) break;
+    }
+    else { // no pidfd (linux < 5.3): poll the child
+      siginfo_t si;
+      si.si_pid = 0;
+      waitid(P_PID,pid,&si,WEXITED|WNOHANG|WNOWAIT);
+      if (si.si_pid == pid) break;
+      pollfd fd = {tfd,POLLIN,0};
+      poll(&fd,1,10);
+      if (!fd.revents) continue;
+    }
+    kill(-pid,SIGKILL);
+    ans = true;
+    break;
+  }
+  if (pidfd >= 0) ::close(pidfd);
+  ::close(tfd);
+  return ans;
+}
+
+// cgroups
+static string cgroup_tried; // last path given by pjudge
+static string cgroup_base; // set up by the launcher, empty if unusable
+
+static bool write_file(const string& fn, const string& data) {
+  int fd = open(fn.c_str(),O_WRONLY|O_CLOEXEC);
+  if (fd < 0) return false;
+  bool ans = write(fd,data.c_str(),data.size()) == ssize_t(data.size());
+  ::close(fd);
+  return ans;
+}
+
+static long long read_key(const string& fn, const string& key) { // or -1
+  ifstream f(fn.c_str());
+  long long v;
+  for (string k; f >> k >> v;) if (k == key) return v;
+  return -1;
+}
+
+static bool controllers(const string& dir) {
+  ifstream f((dir+"/cgroup.subtree_control").c_str());
+  bool memory = false, pids = false;
+  for (string c; f >> c;) {
+    if (c == "memory") memory = true;
+    if (c == "pids") pids = true;
+  }
+  return memory && pids;
+}
+
+static void setup_cgroup(const string& path) {
+  if (path == cgroup_tried) return;
+  cgroup_tried = path;
+  cgroup_base = "";
+  if (path.empty()) return;
+  bool created = mkdir(path.c_str(),0755) == 0;
+  if (!created && errno != EEXIST) return;
+  // controllers must be enabled in the parent and in the base itself, which
+  // holds no processes
+  string parent = path.substr(0,path.rfind('/'));
+  if (!controllers(parent)) {
+    write_file(parent+"/cgroup.subtree_control","+memory +pids");
+  }
+  write_file(path+"/cgroup.subtree_control","+memory +pids");
+  if (controllers(parent) && controllers(path)) cgroup_base = path;
+  else if (created) rmdir(path.c_str());
+}
+
+static string create_cgroup(const Launcher::Limits& lim) { // or ""
+  if (cgroup_base.empty()) return "";
+  string cg = cgroup_base+"/run"+to_string(getpid());
+  if (mkdir(cg.c_str(),0755) < 0) return "";
+  bool ok = true;
+  if (lim.memory > 0) {
+    ok = ok && write_file(cg+"/memory.max",to_string(lim.memory*1024));
+    write_file(cg+"/memory.swap.max","0"); // absent without swap accounting
+  }
+  if (lim.pids > 0) ok = ok && write_file(cg+"/pids.max",to_string(lim.pids));
+  if (!ok) {
+    rmdir(cg.c_str());
+    return "";
+  }
+  return cg;
+}
+
+static void remove_cgroup(const string& cg, Launcher::Result& res) {
+  write_file(cg+"/cgroup.kill","1"); // whatever the run left behind
+  res.cpu = read_key(cg+"/cpu.stat","usage_usec");
+  res.oom = read_key(cg+"/memory.events","oom_kill") > 0;
+  // the cgroup can only be removed after the killed tasks are gone
+  for (int i = 0; i < 100 && rmdir(cg.c_str()) < 0 && errno == EBUSY; i++) {
+    usleep(1000);
+  }
+}
+
+static void monitor(Request& req, int in, int out, int reply) {
+  Reply rep;
+  memset(&rep,0,sizeof rep);
+  auto& lim = req.limits;
+  vector<char*> argv = split(req.cmd);
+  string cg = create_cgroup(lim);
+  long long start = now();
+  rep.pid = fork();
+  if (!rep.pid) {
+    setpgid(0,0); // killed as a group
+    if (cg.size() && !write_file(cg+"/cgroup.procs","0")) _exit(-1);
+    dup2(in,0);
+    dup2(out,1);
+    if (CPU_COUNT(&lim.cpus)) sched_setaffinity(0,sizeof lim.cpus,&lim.cpus);
+    rlimit r;
+    if (lim.cpu_time > 0) {
+      r.rlim_cur = r.rlim_max = lim.cpu_time;
+      setrlimit(RLIMIT_CPU,&r);
+    }
+    r.rlim_cur = r.rlim_max = RLIM_INFINITY;
+    setrlimit(RLIMIT_STACK,&r);
+    if (argv[0]) execvp(argv[0],&argv[0]);
+    _exit(-1);
+  }
+  if (rep.pid > 0) setpgid(rep.pid,rep.pid); // before the pid is sent
+  ::close(in);
+  ::close(out);
+  send(reply,&rep,sizeof rep,MSG_NOSIGNAL);
+  auto& res = rep.result;
+  res.cpu = -1;
+  if (rep.pid >= 0) {
+    res.timeout = expire(rep.pid,lim.wall_time);
+    while (wait4(rep.pid,&res.status,0,&res.usage) < 0 && errno == EINTR);
+    res.wall = now()-start;
+    kill(-rep.pid,SIGKILL); // whatever the run left behind in its group
+  }
+  if (cg.size()) remove_cgroup(cg,res);
+  if (rep.pid >= 0) send(reply,&rep,sizeof rep,MSG_NOSIGNAL);
+}
+
+static void close_fds(int keep) { // all but stdio and keep
+  vector<int> fds;
+  DIR* dir = opendir("/proc/self/fd");
+  if (!dir) return;
+  for (dirent* ent = readdir(dir); ent; ent = readdir(dir)) {
+    int fd = atoi(ent->d_name);
+    if (fd > 2 && fd != keep && fd != dirfd(dir)) fds.push_back(fd);
+  }
+  closedir(dir);
+  for (int fd : fds) ::close(fd);
+}
+
+static void serve(int fd) {
+  close_fds(fd); // a launcher forked again holds no sockets or files of pjudge
+  prctl(PR_SET_PDEATHSIG,SIGKILL);
+  signal(SIGCHLD,SIG_IGN); // monitors are reaped automatically
+  Request req;
+  int fds[3];
+  for (ssize_t n; (n = recv_fds(fd,&req,sizeof req,fds,3)) != 0;) {
+    if (n < 0) continue;
+    req.cmd[MAX_CMD-1] = 0;
+    req.cgroup[MAX_PATH-1] = 0;
+    setup_cgroup(req.cgroup);
+    if (!fork()) {
+      ::close(fd);
+      signal(SIGCHLD,SIG_DFL);
+      monitor(req,fds[0],fds[1],fds[2]);
+      _exit(0);
+    }
+    for (int i = 0; i < 3; i++) ::close(fds[i]);
+  }
+  _exit(0);
+}
+
+static void start() { // before any thread, or with sock_mutex locked
+  int fds[2];
+  if (socketpair(AF_UNIX,SOCK_SEQPACKET|SOCK_CLOEXEC,0,fds) < 0) return;
+  launcher = fork();
+  if (!launcher) {
+    ::close(fds[0]);
+    serve(fds[1]);
+  }
+  ::close(fds[1]);
+  if (launcher < 0) ::close(fds[0]);
+  else sock = fds[0];
+}
+
+// forks the launcher again if the one behind sock old is gone. false if it
+// is still there (so the request failed for another reason) or can't be
+// forked
+static bool restart(int old) {
+  pthread_mutex_lock(&sock_mutex);
+  bool ans = (sock != old); // already restarted by another thread
+  if (!ans && (sock < 0 || waitpid(launcher,nullptr,WNOHANG) != 0)) {
+    if (sock >= 0) ::close(sock);
+    sock = -1;
+    start();
+    ans = (sock >= 0);
+  }
+  pthread_mutex_unlock(&sock_mutex);
+  return ans;
+}
+
+static int request(const Request& req, int in, int out, pid_t& pid, int& s) {
+  int rfds[2];
+  if (socketpair(AF_UNIX,SOCK_SEQPACKET|SOCK_CLOEXEC,0,rfds) < 0) return -1;
+  int fds[3] = {in,out,rfds[1]};
+  pthread_mutex_lock(&sock_mutex);
+  s = sock;
+  bool ok = s >= 0 && send_fds(s,&req,sizeof req,fds,3);
+  pthread_mutex_unlock(&sock_mutex);
+  ::close(rfds[1]);
+  Reply rep;
+  if (!ok || recv(rfds[0],&rep,sizeof rep,0) != sizeof rep || rep.pid < 0) {
+    ::close(rfds[0]);
+    return -1;
+  }
+  pid = rep.pid;
+  return rfds[0];
+}
+
+namespace Launcher {
+
+void init() {
+  start();
+}
+
+void close() {
+  if (sock < 0) return;
+  ::close(sock); // the launcher exits
+  sock = -1;
+  waitpid(launcher,nullptr,0);
+}
+
+bool cgroup(const string& path) {
+  cgroup_path = path.size() < MAX_PATH ? path : "";
+  setup_cgroup(cgroup_path); // the launcher repeats it, but we want to know
+  return !cgroup_base.empty();
+}
+
+int spawn(
+  const string& cmd,
+  int in,
+  int out,
+  const Limits& limits,
+  pid_t& pid
+) {
+  if (MAX_CMD <= cmd.size()) return -1;
+  Request req;
+  req.limits = limits;
+  strcpy(req.cgroup,cgroup_path.c_str());
+  strcpy(req.cmd,cmd.c_str());
+  int s, handle = request(req,in,out,pid,s);
+  if (handle < 0 && restart(s)) handle = request(req,in,out,pid,s);
+  return handle;
+}
+
+bool wait(int handle, Result& result) {
+  Reply rep;
+  ssize_t n;
+  while ((n = recv(handle,&rep,sizeof rep,0)) < 0 && errno == EINTR);
+  ::close(handle);
+  if (n != sizeof rep) return false;
+  result = rep.result;
+  return true;
+}
+
+} // namespace Launcher
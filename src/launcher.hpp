@@ -0,0 +1,54 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <string>
+
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+namespace Launcher {
+
+void init(); // forks the launcher. call it before creating any thread
+void close();
+
+// cgroup v2 directory under which each run gets its own cgroup. empty (the
+// default) disables cgroups. call it before spawning anything. returns false
+// if the directory can't be set up (then runs get no cgroup)
+bool cgroup(const std::string& path);
+
+struct Limits {
+  cpu_set_t cpus; // cpus to pin the run to, or empty
+  int cpu_time; // seconds of RLIMIT_CPU, or 0
+  int wall_time; // milliseconds, or 0
+  long long memory; // kB of memory.max, or 0
+  int pids; // pids.max, or 0
+};
+
+struct Result {
+  int status;
+  rusage usage;
+  long long wall; // microseconds
+  bool timeout; // killed after wall_time
+  // from the run's cgroup, or -1 (and false) if it had none. memory is left
+  // to usage.ru_maxrss: the cgroup's peak counts the page cache too
+  long long cpu; // microseconds
+  bool oom; // killed for exceeding the memory limit
+};
+
+// runs cmd (split at spaces, or given to /bin/sh if it has shell syntax) with
+// the given stdin and stdout and limits. the memory and pids limits are only
+// enforced if the run got a cgroup. returns a handle for wait(), or -1 if the
+// run couldn't be started (a launcher that died is forked again first)
+int spawn(
+  const std::string& cmd,
+  int in,
+  int out,
+  const Limits& limits,
+  pid_t& pid // process group of the run
+);
+bool wait(int handle, Result& result);
+
+} // namespace Launcher
+
+#endif
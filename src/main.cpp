@@ -20,6 +20,8 @@ static void usage() {
     "\n"
     "Offline options:\n"
     "  start\n"
+    "  export-db (writes database/*.json from the binary database)\n"
+    "  import-db (replaces the binary database by database/*.json)\n"
     "\n"
     "Online options:\n"
     "  stop\n"
@@ -41,6 +43,12 @@ int main(int argc, char** argv) {
   funcs["start"][0] = [](const vector<string>&) {
     Global::start();
   };
+  funcs["export-db"][0] = [](const vector<string>&) {
+    Global::export_database();
+  };
+  funcs["import-db"][0] = [](const vector<string>&) {
+    Global::import_database();
+  };
   funcs["stop"][0] = [](const vector<string>&) {
     Global::stop();
   };
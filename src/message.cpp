@@ -33,7 +33,7 @@ void Message::process() {
       Global::shutdown();
       break;
     case RERUN_ATT:
-      Judge::push(data.attid);
+      Judge::push(data.attid,true);
       break;
   }
 }
@@ -0,0 +1,183 @@
+#include <map>
+#include <climits>
+#include <algorithm>
+
+#include "scoreboard.hpp"
+
+#include "helper.hpp"
+#include "database.hpp"
+#include "user.hpp"
+
+using namespace std;
+
+// an attempt that counts for the scoreboard
+struct Entry {
+  int contest, user, problem;
+  pair<int,int> key; // (contest time, attempt id)
+  bool ac;
+};
+
+// (contest time, attempt id) -> AC, for each user and problem
+typedef map<int,map<int,map<pair<int,int>,bool>>> Cells;
+
+struct View {
+  unsigned version;
+  vector<int> problems;
+  int cutoff;
+  JSON teams;
+};
+
+struct Board {
+  Cells cells;
+  unsigned version;
+  View views[2]; // cached rankings: complete and frozen
+  Board() : version(1) {
+    views[0].version = views[1].version = 0;
+  }
+};
+
+struct Team {
+  int user, num, time;
+  vector<int> ACs;
+  JSON problems;
+  string name;
+};
+
+static map<int,Entry> entries; // attempt id -> entry
+static map<int,Board> boards;  // contest id -> board
+static pthread_mutex_t scoreboard_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool entry(const JSON& att, Entry& e) {
+  int tmp;
+  if (
+    att("privileged") ||
+    att("status") != "judged" ||
+    !att("contest").read(e.contest) ||
+    !att("contest_time").read(tmp)
+  ) return false;
+  e.user = att("user");
+  e.problem = att("problem");
+  e.key.first = tmp;
+  e.ac = (verdict_toi(att("verdict")) == AC);
+  return true;
+}
+
+static void insert(int attid, const Entry& e) {
+  auto& b = boards[e.contest];
+  b.cells[e.user][e.problem][e.key] = e.ac;
+  b.version++;
+  entries[attid] = e;
+}
+
+static void erase(int attid) {
+  auto it = entries.find(attid);
+  if (it == entries.end()) return;
+  auto& e = it->second;
+  auto bt = boards.find(e.contest);
+  if (bt != boards.end()) {
+    auto& b = bt->second;
+    auto& ps = b.cells[e.user];
+    auto& atts = ps[e.problem];
+    atts.erase(e.key);
+    if (atts.empty()) ps.erase(e.problem);
+    if (ps.empty()) b.cells.erase(e.user);
+    b.version++;
+  }
+  entries.erase(it);
+}
+
+static Board& load(int cid) { // call with the mutex locked
+  auto it = boards.find(cid);
+  if (it != boards.end()) return it->second;
+  auto& b = boards[cid];
+  DB(attempts);
+  JSON tmp = attempts.retrieve(map<string,JSON>{{"contest",cid}});
+  Entry e;
+  for (auto& att : tmp.arr()) if (entry(att,e) && e.contest == cid) {
+    e.key.second = att["id"];
+    insert(e.key.second,e);
+  }
+  return b;
+}
+
+static JSON standings(Board& b, const vector<int>& problems, int cutoff) {
+  vector<Team> teams;
+  for (auto& us : b.cells) {
+    Team t;
+    t.user = us.first;
+    t.num = t.time = 0;
+    t.problems = JSON(vector<JSON>{});
+    bool tried = false;
+    for (int pid : problems) {
+      int atts = 0, time = 0;
+      auto it = us.second.find(pid);
+      if (it != us.second.end()) for (auto& att : it->second) {
+        if (cutoff <= att.first.first) break;
+        if (!att.second) { atts--; continue; }
+        atts = 1-atts;
+        time = att.first.first;
+        t.ACs.push_back(time);
+        t.num++;
+        t.time += 20*(atts-1)+time;
+        break;
+      }
+      if (atts) tried = true;
+      t.problems.push_back(map<string,JSON>{{"atts",atts},{"time",time}});
+    }
+    if (!tried) continue;
+    sort(t.ACs.begin(),t.ACs.end());
+    t.name = User::name(t.user);
+    teams.push_back(move(t));
+  }
+  sort(teams.begin(),teams.end(),[](const Team& a, const Team& b) {
+    if (a.num != b.num) return a.num > b.num;
+    if (a.time != b.time) return a.time < b.time;
+    for (int i = a.num-1; 0 <= i; i--) {
+      if (a.ACs[i] != b.ACs[i]) return a.ACs[i] < b.ACs[i];
+    }
+    return a.name < b.name;
+  });
+  JSON ans(vector<JSON>{});
+  for (auto& t : teams) ans.push_back(map<string,JSON>{
+    {"name"     , t.name},
+    {"problems" , move(t.problems)},
+    {"score"    , map<string,JSON>{{"num",t.num},{"time",t.time}}}
+  });
+  return ans;
+}
+
+namespace Scoreboard {
+
+void update(int attid) {
+  DB(attempts);
+  JSON att;
+  Entry e;
+  pthread_mutex_lock(&scoreboard_mutex);
+  erase(attid);
+  if (
+    attempts.retrieve(attid,att) &&
+    entry(att,e) &&
+    boards.find(e.contest) != boards.end() // not loaded? load() reads it
+  ) {
+    e.key.second = attid;
+    insert(attid,e);
+  }
+  pthread_mutex_unlock(&scoreboard_mutex);
+}
+
+JSON get(int contest, const vector<int>& problems, int cutoff) {
+  pthread_mutex_lock(&scoreboard_mutex);
+  auto& b = load(contest);
+  auto& v = b.views[cutoff == INT_MAX ? 0 : 1];
+  if (v.version != b.version || v.problems != problems || v.cutoff != cutoff) {
+    v.version = b.version;
+    v.problems = problems;
+    v.cutoff = cutoff;
+    v.teams = standings(b,problems,cutoff);
+  }
+  JSON ans = v.teams;
+  pthread_mutex_unlock(&scoreboard_mutex);
+  return ans;
+}
+
+} // namespace Scoreboard
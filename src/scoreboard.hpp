@@ -0,0 +1,15 @@
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include <vector>
+
+#include "json.hpp"
+
+namespace Scoreboard {
+
+void update(int attid); // call whenever an attempt changes
+JSON get(int contest, const std::vector<int>& problems, int cutoff); // ranked
+
+} // namespace Scoreboard
+
+#endif
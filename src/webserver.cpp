@@ -249,6 +249,7 @@ void init() {
 
 void close() {
   quit = true;
+  HTTP::interrupt();
   pthread_join(webserver,nullptr);
 }
 